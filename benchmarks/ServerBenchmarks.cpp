@@ -0,0 +1,527 @@
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/Common/BlacklistFormat.h"
+#include "../src/Common/ConfigLoader.h"
+#include "../src/Common/Imsi.h"
+#include "../src/Common/Timestamp.h"
+#include "../src/Pgw/BlackListStorer.h"
+#include "../src/Pgw/CdrWriter.h"
+#include "../src/Pgw/ControlPlaneServer.h"
+#include "../src/Pgw/SessionManager.h"
+#include "../src/Pgw/SessionStore.h"
+#include "../src/Pgw/UdpServer.h"
+#include "spdlog/sinks/null_sink.h"
+
+namespace {
+constexpr std::size_t BURST = 32;
+
+std::shared_ptr<spdlog::logger> make_null_logger () {
+    return std::make_shared<spdlog::logger> ("bench", std::make_shared<spdlog::sinks::null_sink_mt> ());
+}
+
+void ensure_project_dir () {
+    setenv ("PROJECT_DIR", std::filesystem::temp_directory_path ().c_str (), 0);
+    std::filesystem::create_directories (std::filesystem::path (std::getenv ("PROJECT_DIR")) / "logs");
+}
+
+std::vector<uint8_t> encode_imsi_bcd (std::string imsi) {
+    if (imsi.size () % 2 != 0)
+        imsi.push_back ('F');
+    std::vector<uint8_t> bytes;
+    for (std::size_t i = 0; i < imsi.size (); i += 2) {
+        const uint8_t low  = (imsi[i] == 'F' ? 0xF : imsi[i] - '0');
+        const uint8_t high = (imsi[i + 1] == 'F' ? 0xF : imsi[i + 1] - '0');
+        bytes.push_back (static_cast<uint8_t> ((high << 4) | low));
+    }
+    return bytes;
+}
+
+Common::ServerSettings bench_settings (const uint16_t port) {
+    Common::ServerSettings s{};
+    s.udp_ip                 = "127.0.0.1";
+    s.udp_port               = port;
+    s.session_timeout_sec    = 600;
+    s.graceful_shutdown_rate = 1000;
+    s.cdr_file               = (std::filesystem::temp_directory_path () / "cdr_bench.log").string ();
+    s.log_file               = "bench_pgw.log";
+    s.log_level              = spdlog::level::warn;
+    return s;
+}
+
+int connect_client (const Common::ServerSettings& s) {
+    const int fd = socket (AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons (s.udp_port);
+    inet_aton (s.udp_ip.c_str (), &addr.sin_addr);
+    connect (fd, reinterpret_cast<sockaddr*> (&addr), sizeof addr);
+    return fd;
+}
+
+std::size_t round_trip (const int fd, const std::vector<std::vector<uint8_t> >& payloads) {
+    for (const auto& p : payloads)
+        send (fd, p.data (), p.size (), 0);
+
+    std::size_t received = 0;
+    char buf[64];
+    pollfd pfd{ fd, POLLIN, 0 };
+    while (received < payloads.size () && poll (&pfd, 1, 100) > 0) {
+        while (recv (fd, buf, sizeof buf, MSG_DONTWAIT) > 0)
+            ++received;
+    }
+    return received;
+}
+
+// Keep-alive TCP connection to the control plane on loopback; -1 while nothing listens on port.
+int connect_http (const uint16_t port) {
+    const int fd = socket (AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons (port);
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (connect (fd, reinterpret_cast<sockaddr*> (&addr), sizeof addr) != 0) {
+        close (fd);
+        return -1;
+    }
+    const int one = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    return fd;
+}
+
+// Sends one HTTP/1.1 request and reads the whole response into buf; false unless the answer is a 200.
+bool http_exchange (const int fd, const std::string_view request, std::string& buf) {
+    if (send (fd, request.data (), request.size (), MSG_NOSIGNAL) != static_cast<ssize_t> (request.size ()))
+        return false;
+    static constexpr std::string_view CONTENT_LENGTH = "Content-Length: ";
+    buf.clear ();
+    std::size_t header_end = std::string::npos, total = std::string::npos;
+    char chunk[4096];
+    while (total == std::string::npos || buf.size () < total) {
+        const ssize_t n = recv (fd, chunk, sizeof chunk, 0);
+        if (n <= 0)
+            return false;
+        buf.append (chunk, static_cast<std::size_t> (n));
+        if (header_end != std::string::npos || (header_end = buf.find ("\r\n\r\n")) == std::string::npos)
+            continue;
+        std::size_t body = 0;
+        if (const auto at = buf.find (CONTENT_LENGTH); at < header_end)
+            body = std::strtoul (buf.c_str () + at + CONTENT_LENGTH.size (), nullptr, 10);
+        total = header_end + 4 + body;
+    }
+    return buf.starts_with ("HTTP/1.1 200");
+}
+
+constexpr std::size_t SESSION_POOL = 1 << 16;
+std::unique_ptr<CdrWriter> g_session_cdr;
+std::unique_ptr<SessionManager> g_sessions;
+std::vector<Common::Imsi> g_session_imsis;
+
+void setup_sessions (const benchmark::State& state) {
+    auto settings = bench_settings (0);
+    g_session_cdr = std::make_unique<CdrWriter> (settings, make_null_logger ());
+    g_sessions    = std::make_unique<SessionManager> (600, *g_session_cdr, make_null_logger (), state.range (0));
+    g_session_imsis.clear ();
+    for (std::size_t i = 0; i < SESSION_POOL; ++i) {
+        g_session_imsis.push_back (Common::Imsi::from_string ("25099" + std::to_string (1'000'000'000 + i)));
+        g_sessions->create_session (g_session_imsis.back ());
+    }
+}
+
+void teardown_sessions (const benchmark::State&) {
+    g_sessions.reset ();
+    g_session_cdr.reset ();
+}
+
+// Thread t's own IMSIs: pool IMSIs with the third digit (0 in the pool) set to t + 1.
+Common::Imsi thread_imsi (const std::size_t thread, const std::size_t i) {
+    return Common::Imsi::from_raw (g_session_imsis[i & (SESSION_POOL - 1)].raw () | ((thread + 1) << 52));
+}
+
+// Built once per (entries, mapped) and kept for the whole run: a million-entry store takes seconds.
+BlackListStorer& blacklist_fixture (const std::size_t entries, const bool mapped) {
+    static std::map<std::pair<std::size_t, bool>, std::unique_ptr<BlackListStorer> > fixtures;
+    auto& bl = fixtures[{ entries, mapped }];
+    if (bl)
+        return *bl;
+    bl = std::make_unique<BlackListStorer> (1024, make_null_logger ());
+    if (mapped) {
+        std::vector<uint64_t> raw;
+        for (std::size_t i = 0; i < entries; ++i)
+            raw.push_back (Common::Imsi::from_string ("25099" + std::to_string (1'000'000'000 + 7 * i)).raw ());
+        const auto path = std::filesystem::temp_directory_path () / ("blacklist_bench_" + std::to_string (entries));
+        Common::write_blacklist_file (path.c_str (), std::move (raw), {});
+        bl->watch (path, std::chrono::milliseconds (0));
+    } else {
+        std::unordered_set<std::string> imsis;
+        for (std::size_t i = 0; i < entries; ++i)
+            imsis.insert ("25099" + std::to_string (1'000'000'000 + 7 * i));
+        bl->store (imsis);
+    }
+    return *bl;
+}
+
+std::unique_ptr<CdrWriter> g_cdr;
+
+void setup_cdr (const benchmark::State&) {
+    ensure_project_dir ();
+    auto settings = bench_settings (0);
+    g_cdr         = std::make_unique<CdrWriter> (settings, make_null_logger ());
+}
+
+void teardown_cdr (const benchmark::State&) {
+    g_cdr.reset ();
+}
+} // namespace
+
+// Request decoding: the digit string the packet path used to build, and the packed Imsi it builds now.
+static void BM_BcdToImsi (benchmark::State& state) {
+    const auto bcd = encode_imsi_bcd ("250991234567890");
+    for (auto _ : state)
+        benchmark::DoNotOptimize (Pgw::UdpServer::bcd_to_imsi (bcd.data (), bcd.size ()));
+}
+BENCHMARK (BM_BcdToImsi);
+
+static void BM_ImsiFromBcd (benchmark::State& state) {
+    const auto bcd = encode_imsi_bcd ("250991234567890");
+    for (auto _ : state)
+        benchmark::DoNotOptimize (Common::Imsi::from_bcd (bcd.data (), bcd.size ()));
+}
+BENCHMARK (BM_ImsiFromBcd);
+
+// is_in_blacklist over 4096 distinct IMSIs, all listed (hit) or all on another network (miss, the common case).
+static void BM_BlacklistLookup (benchmark::State& state) {
+    const auto entries = static_cast<std::size_t> (state.range (0));
+    const auto& bl     = blacklist_fixture (entries, state.range (1) != 0);
+    const bool hit     = state.range (2) != 0;
+
+    std::vector<Common::Imsi> queries;
+    for (std::size_t i = 0; i < 4096; ++i)
+        queries.push_back (Common::Imsi::from_string (
+        (hit ? "25099" : "25098") + std::to_string (1'000'000'000 + 7 * ((i * 7919) % entries))));
+
+    std::size_t i = 0;
+    for (auto _ : state)
+        benchmark::DoNotOptimize (bl.is_in_blacklist (queries[i++ & 4095]));
+}
+BENCHMARK (BM_BlacklistLookup)
+->ArgsProduct ({ { 1 << 10, 1 << 20 }, { 0, 1 }, { 0, 1 } })
+->ArgNames ({ "entries", "mapped", "hit" });
+
+// Attach of an IMSI without a session, each thread on its own IMSIs; arg is the shard count. Every SESSION_POOL
+// iterations the thread's sessions are removed again with the clock paused.
+static void BM_SessionCreate (benchmark::State& state) {
+    const auto thread = static_cast<std::size_t> (state.thread_index ());
+    std::size_t i     = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize (g_sessions->create_session (thread_imsi (thread, i)));
+        if (++i % SESSION_POOL == 0) {
+            state.PauseTiming ();
+            for (std::size_t k = 0; k < SESSION_POOL; ++k)
+                g_sessions->remove_session (thread_imsi (thread, k));
+            state.ResumeTiming ();
+        }
+    }
+    state.SetItemsProcessed (state.iterations ());
+}
+BENCHMARK (BM_SessionCreate)
+->Arg (64)
+->ThreadRange (1, 8)
+->UseRealTime ()
+->Setup (setup_sessions)
+->Teardown (teardown_sessions);
+
+// has_session on live IMSIs (hit) or IMSIs without a session (miss); args are the shard count and hit.
+static void BM_SessionLookup (benchmark::State& state) {
+    const auto thread = static_cast<std::size_t> (state.thread_index ());
+    const bool hit    = state.range (1) != 0;
+    std::size_t i     = thread * 7919;
+    for (auto _ : state) {
+        const auto imsi = hit ? g_session_imsis[i & (SESSION_POOL - 1)] : thread_imsi (thread, i);
+        benchmark::DoNotOptimize (g_sessions->has_session (imsi));
+        ++i;
+    }
+    state.SetItemsProcessed (state.iterations ());
+}
+BENCHMARK (BM_SessionLookup)
+->Args ({ 64, 1 })
+->Args ({ 64, 0 })
+->ThreadRange (1, 8)
+->UseRealTime ()
+->Setup (setup_sessions)
+->Teardown (teardown_sessions);
+
+// Warm restart of arg sessions from a snapshot file: map, decode and bulk load, as done before UdpServer::start.
+static void BM_SessionRestore (benchmark::State& state) {
+    ensure_project_dir ();
+    const auto path                        = std::filesystem::temp_directory_path () / "sessions_bench.snap";
+    auto settings                          = bench_settings (0);
+    settings.session_snapshot_file         = path.string ();
+    settings.session_snapshot_interval_sec = 0;
+    const auto logger                      = make_null_logger ();
+    CdrWriter cdr (settings, logger);
+    {
+        std::vector<SessionManager::SessionEvent> events;
+        const auto now = std::chrono::steady_clock::now ();
+        for (int64_t i = 0; i < state.range (0); ++i)
+            events.push_back ({ Common::Imsi::from_string ("25099" + std::to_string (1'000'000'000 + i)), now });
+        SessionManager sessions (settings.session_timeout_sec, cdr, logger);
+        sessions.restore (events);
+        SessionStore (settings, sessions, logger).snapshot ();
+    }
+
+    for (auto _ : state) {
+        auto sessions = std::make_unique<SessionManager> (settings.session_timeout_sec, cdr, logger);
+        benchmark::DoNotOptimize (SessionStore (settings, *sessions, logger).restore ());
+        state.PauseTiming ();
+        sessions.reset ();
+        state.ResumeTiming ();
+    }
+    state.SetItemsProcessed (state.iterations () * state.range (0));
+}
+BENCHMARK (BM_SessionRestore)->Arg (1 << 20)->Iterations (5)->Unit (benchmark::kMillisecond);
+
+// Producer side of CdrWriter::write. The ring is small next to the iteration count, so the sustained rate is bound
+// by the writer thread; "queue_full_stalls" counts writes that had to wait for it.
+static void BM_CdrWrite (benchmark::State& state) {
+    const auto imsi  = Common::Imsi::from_string ("250991234567890");
+    const auto shard = static_cast<uint16_t> (state.thread_index ());
+    for (auto _ : state)
+        g_cdr->write (imsi, Common::CdrAction::created, shard);
+    state.SetItemsProcessed (state.iterations ());
+    if (state.thread_index () == 0)
+        state.counters["queue_full_stalls"] = static_cast<double> (g_cdr->queue_full_stalls ());
+}
+BENCHMARK (BM_CdrWrite)->ThreadRange (1, 4)->UseRealTime ()->Setup (setup_cdr)->Teardown (teardown_cdr);
+
+// Process CPU time (all threads) in microseconds.
+static double cpu_time_us () {
+    rusage usage{};
+    getrusage (RUSAGE_SELF, &usage);
+    return static_cast<double> (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6
+    + static_cast<double> (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+// Loopback burst of BURST requests per iteration; args are udp_batch_size (1 = recvfrom/sendto path in the staged
+// pipeline), the I/O backend (0 = epoll, 1 = io_uring) and the pipeline (0 = staged, 1 = run-to-completion, epoll
+// only). cpu_us_per_pkt includes the client side, which is the same for every variant.
+static void BM_UdpRoundTrip (benchmark::State& state) {
+    ensure_project_dir ();
+    auto settings           = bench_settings (19200);
+    settings.udp_batch_size = static_cast<std::size_t> (state.range (0));
+    settings.udp_io_backend = state.range (1) ? "io_uring" : "epoll";
+    settings.udp_pipeline   = state.range (2) ? "run_to_completion" : "staged";
+
+    const auto logger = make_null_logger ();
+    auto cdr          = std::make_shared<CdrWriter> (settings, logger);
+    auto sessions     = std::make_shared<SessionManager> (settings.session_timeout_sec, *cdr, logger);
+    auto blacklist    = std::make_shared<BlackListStorer> (1'000'003, logger);
+    Pgw::UdpServer server (settings, nullptr, sessions, blacklist, cdr);
+    server.start ();
+
+    std::vector<std::vector<uint8_t> > payloads;
+    for (std::size_t i = 0; i < BURST; ++i)
+        payloads.push_back (encode_imsi_bcd ("2509900000" + std::to_string (10000 + i)));
+
+    const int fd = connect_client (settings);
+    round_trip (fd, payloads);
+
+    std::size_t lost      = 0;
+    const auto before     = server.io_stats ();
+    const double cpu_from = cpu_time_us ();
+    for (auto _ : state)
+        lost += BURST - round_trip (fd, payloads);
+    const double cpu_used = cpu_time_us () - cpu_from;
+    const auto after      = server.io_stats ();
+    close (fd);
+
+    const auto rx_packets = static_cast<double> (std::max<uint64_t> (after.rx_packets - before.rx_packets, 1));
+    const auto tx_packets = static_cast<double> (std::max<uint64_t> (after.tx_packets - before.tx_packets, 1));
+    state.counters["rx_syscalls_per_pkt"] = static_cast<double> (after.rx_syscalls - before.rx_syscalls) / rx_packets;
+    state.counters["tx_syscalls_per_pkt"] = static_cast<double> (after.tx_syscalls - before.tx_syscalls) / tx_packets;
+    state.counters["cpu_us_per_pkt"]      = cpu_used / rx_packets;
+    // Server side receive-to-send time, warm-up burst included.
+    const auto latency              = server.response_latency ();
+    state.counters["server_p50_us"] = static_cast<double> (latency.quantile (0.5)) / 1000;
+    state.counters["server_p99_us"] = static_cast<double> (latency.quantile (0.99)) / 1000;
+    state.counters["lost"]                = static_cast<double> (lost);
+    // 0 when io_uring was requested but the kernel made the server fall back to epoll.
+    state.counters["io_uring"] = static_cast<double> (server.io_uring_shards ());
+    state.SetItemsProcessed (static_cast<int64_t> (state.iterations () * BURST));
+}
+BENCHMARK (BM_UdpRoundTrip)
+->ArgsProduct ({ { 1, 8, 32 }, { 0, 1 }, { 0 } })
+->ArgsProduct ({ { 1, 8, 32 }, { 0 }, { 1 } })
+->ArgNames ({ "batch", "io_uring", "rtc" })
+->UseRealTime ()
+->Unit (benchmark::kMicrosecond);
+
+// BM_UdpRoundTrip bursts while arg keep-alive clients poll GET /check_subscriber on a running ControlPlaneServer
+// (http_threads = 4). Both rates cover the same window: items_per_second (UDP) should hold as clients are added,
+// while "http_reqs" grows until the HTTP threads saturate.
+static void BM_HttpUnderUdpLoad (benchmark::State& state) {
+    ensure_project_dir ();
+    auto settings         = bench_settings (19201);
+    settings.http_port    = 18201;
+    settings.http_threads = 4;
+
+    const auto logger = make_null_logger ();
+    auto cdr          = std::make_shared<CdrWriter> (settings, logger);
+    auto sessions     = std::make_shared<SessionManager> (settings.session_timeout_sec, *cdr, logger);
+    auto blacklist    = std::make_shared<BlackListStorer> (1'000'003, logger);
+    Pgw::UdpServer server (settings, nullptr, sessions, blacklist, cdr);
+    server.start ();
+    ControlPlaneServer http (settings, *sessions, [] {}, logger);
+    http.start ();
+
+    std::vector<std::vector<uint8_t> > payloads;
+    for (std::size_t i = 0; i < BURST; ++i)
+        payloads.push_back (encode_imsi_bcd ("2509900000" + std::to_string (10000 + i)));
+
+    const int fd = connect_client (settings);
+    round_trip (fd, payloads);
+
+    // Crow binds the port on its own thread after start () returns.
+    const auto clients = static_cast<std::size_t> (state.range (0));
+    std::vector<int> conns;
+    for (std::size_t i = 0; i < clients; ++i) {
+        int conn = connect_http (static_cast<uint16_t> (settings.http_port));
+        for (int attempt = 0; conn < 0 && attempt < 200; ++attempt) {
+            std::this_thread::sleep_for (std::chrono::milliseconds (10));
+            conn = connect_http (static_cast<uint16_t> (settings.http_port));
+        }
+        if (conn < 0)
+            break;
+        conns.push_back (conn);
+    }
+    if (conns.size () < clients) {
+        for (const int conn : conns)
+            close (conn);
+        close (fd);
+        state.SkipWithError ("control plane did not accept connections");
+        return;
+    }
+
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> http_ok{ 0 }, http_failed{ 0 };
+    std::vector<std::thread> pollers;
+    for (std::size_t i = 0; i < clients; ++i) {
+        pollers.emplace_back ([&, conn = conns[i], i] {
+            const std::string request = "GET /check_subscriber?imsi=2509900000" + std::to_string (10000 + i % BURST)
+            + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+            std::string buf;
+            while (!stop.load (std::memory_order_relaxed)) {
+                if (!http_exchange (conn, request, buf)) {
+                    http_failed.fetch_add (1, std::memory_order_relaxed);
+                    break;
+                }
+                http_ok.fetch_add (1, std::memory_order_relaxed);
+            }
+            close (conn);
+        });
+    }
+
+    std::size_t lost     = 0;
+    const auto http_from = http_ok.load (std::memory_order_relaxed);
+    for (auto _ : state)
+        lost += BURST - round_trip (fd, payloads);
+    const auto http_done = http_ok.load (std::memory_order_relaxed) - http_from;
+    stop.store (true, std::memory_order_relaxed);
+    for (auto& t : pollers)
+        t.join ();
+    close (fd);
+
+    state.counters["http_reqs"] = benchmark::Counter (static_cast<double> (http_done), benchmark::Counter::kIsRate);
+    state.counters["http_failed"] = static_cast<double> (http_failed.load ());
+    state.counters["lost"]        = static_cast<double> (lost);
+    state.SetItemsProcessed (static_cast<int64_t> (state.iterations () * BURST));
+}
+BENCHMARK (BM_HttpUnderUdpLoad)
+->Arg (0)
+->Arg (1)
+->Arg (4)
+->Arg (16)
+->ArgName ("http_clients")
+->UseRealTime ()
+->Unit (benchmark::kMicrosecond);
+
+// Re-attach (create_session on a live IMSI) mixed 1:1 with has_session across threads; arg is the shard count.
+static void BM_SessionContention (benchmark::State& state) {
+    std::size_t i = static_cast<std::size_t> (state.thread_index ()) * 7919;
+    for (auto _ : state) {
+        const auto& imsi = g_session_imsis[i++ & (SESSION_POOL - 1)];
+        benchmark::DoNotOptimize (g_sessions->create_session (imsi));
+        benchmark::DoNotOptimize (g_sessions->has_session (imsi));
+    }
+    state.SetItemsProcessed (state.iterations () * 2);
+}
+BENCHMARK (BM_SessionContention)
+->Arg (1)
+->Arg (64)
+->ThreadRange (1, 8)
+->UseRealTime ()
+->Setup (setup_sessions)
+->Teardown (teardown_sessions);
+
+// Thread 0 plays the packet worker (attach/detach churn), the others the HTTP workers polling has_session. With
+// lookups lock-free, "writes" should hold steady as reader threads are added; arg is the shard count.
+static void BM_LookupUnderChurn (benchmark::State& state) {
+    std::size_t i = static_cast<std::size_t> (state.thread_index ()) * 7919;
+    if (state.thread_index () == 0) {
+        for (auto _ : state) {
+            // 25099... -> 25098..., so churned IMSIs never collide with the pool.
+            const auto imsi = Common::Imsi::from_raw (g_session_imsis[i++ & (SESSION_POOL - 1)].raw () ^ (1ULL << 44));
+            g_sessions->create_session (imsi);
+            g_sessions->remove_session (imsi);
+        }
+        state.counters["writes"] =
+        benchmark::Counter (static_cast<double> (state.iterations ()), benchmark::Counter::kIsRate);
+    } else {
+        for (auto _ : state)
+            benchmark::DoNotOptimize (g_sessions->has_session (g_session_imsis[i++ & (SESSION_POOL - 1)]));
+        state.counters["reads"] =
+        benchmark::Counter (static_cast<double> (state.iterations ()), benchmark::Counter::kIsRate);
+    }
+}
+BENCHMARK (BM_LookupUnderChurn)
+->Arg (64)
+->ThreadRange (1, 8)
+->UseRealTime ()
+->Setup (setup_sessions)
+->Teardown (teardown_sessions);
+
+// Per-record formatting the CDR writer used before TimestampCache.
+static void BM_TimestampOstream (benchmark::State& state) {
+    for (auto _ : state) {
+        const auto now_t = std::chrono::system_clock::to_time_t (std::chrono::system_clock::now ());
+        std::tm tm{};
+        gmtime_r (&now_t, &tm);
+        std::ostringstream ss;
+        ss << std::put_time (&tm, "%Y-%m-%dT%H:%M:%SZ");
+        benchmark::DoNotOptimize (ss.str ());
+    }
+}
+BENCHMARK (BM_TimestampOstream);
+
+// Arg 0 renders seconds, 1 adds milliseconds.
+static void BM_TimestampCache (benchmark::State& state) {
+    Common::TimestampCache cache (state.range (0) != 0);
+    for (auto _ : state)
+        benchmark::DoNotOptimize (cache.format (std::chrono::system_clock::now ()));
+}
+BENCHMARK (BM_TimestampCache)->Arg (0)->Arg (1);
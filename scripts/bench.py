@@ -0,0 +1,41 @@
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+
+BASE_DIR = os.path.dirname(os.path.abspath(__file__))
+project_dir = os.path.abspath(os.path.join(BASE_DIR, '..'))
+
+parser = argparse.ArgumentParser(description='Run the benchmarks with JSON output, optionally against a baseline.')
+parser.add_argument('out', help='JSON result file to write')
+parser.add_argument('--binary', default=os.path.join(project_dir, 'build/benchmarks/benchmarks'))
+parser.add_argument('--baseline', help='earlier JSON result to compare with')
+parser.add_argument('--threshold', type=float, default=0.10,
+                    help='relative slowdown of real_time that counts as a regression')
+# Anything else, e.g. --benchmark_filter=Session, goes to the binary.
+args, extra = parser.parse_known_args()
+
+rev = subprocess.run(['git', 'rev-parse', '--short', 'HEAD'], cwd=project_dir,
+                     capture_output=True, text=True).stdout.strip() or 'unknown'
+subprocess.run([args.binary, '--benchmark_out_format=json', f'--benchmark_out={args.out}',
+                f'--benchmark_context=git_rev={rev}', *extra], check=True)
+
+if not args.baseline:
+    sys.exit(0)
+
+
+def load(path):
+    with open(path, encoding='utf-8') as f:
+        return {b['name']: b for b in json.load(f)['benchmarks'] if b.get('run_type', 'iteration') == 'iteration'}
+
+
+old, new = load(args.baseline), load(args.out)
+regressions = 0
+for name in sorted(new.keys() & old.keys()):
+    change = new[name]['real_time'] / old[name]['real_time'] - 1
+    slower = change > args.threshold
+    regressions += slower
+    print(f'{"REGRESSION" if slower else "":10} {change:+8.1%}  {name}')
+sys.exit(1 if regressions else 0)
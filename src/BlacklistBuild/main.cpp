@@ -0,0 +1,59 @@
+#include "../Common/BlacklistFormat.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compiles a text blacklist (one IMSI or "prefix*" per line, '#' starts a comment) into the binary format that the
+// server mmaps. The output is written next to the target and renamed over it, so a running server never maps a
+// half-written file.
+// Usage: blacklist_build <input.txt> <output.bin>
+int main (int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <input.txt> <output.bin>\n";
+        return 2;
+    }
+    std::ifstream in (argv[1]);
+    if (!in) {
+        std::cerr << "cannot open " << argv[1] << '\n';
+        return 1;
+    }
+
+    std::vector<uint64_t> imsis;
+    std::vector<Common::ImsiRange> ranges;
+    std::size_t line_no = 0, skipped = 0;
+    for (std::string line; std::getline (in, line);) {
+        ++line_no;
+        std::string_view entry = line;
+        entry                  = entry.substr (0, entry.find ('#'));
+        const auto first       = entry.find_first_not_of (" \t\r");
+        if (first == std::string_view::npos)
+            continue;
+        entry = entry.substr (first, entry.find_last_not_of (" \t\r") - first + 1);
+        if (const auto range = Common::parse_imsi_prefix (entry)) {
+            ranges.push_back (*range);
+        } else if (const auto imsi = Common::Imsi::from_string (entry); imsi.valid ()) {
+            imsis.push_back (imsi.raw ());
+        } else {
+            std::cerr << argv[1] << ':' << line_no << ": skipping malformed entry '" << entry << "'\n";
+            ++skipped;
+        }
+    }
+
+    const std::string tmp = std::string (argv[2]) + ".tmp";
+    if (!Common::write_blacklist_file (tmp.c_str (), std::move (imsis), std::move (ranges))) {
+        std::cerr << "cannot write " << tmp << '\n';
+        std::remove (tmp.c_str ());
+        return 1;
+    }
+    std::error_code ec;
+    std::filesystem::rename (tmp, argv[2], ec);
+    if (ec) {
+        std::cerr << "cannot rename " << tmp << " to " << argv[2] << ": " << ec.message () << '\n';
+        return 1;
+    }
+    return skipped == 0 ? 0 : 3;
+}
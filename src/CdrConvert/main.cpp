@@ -0,0 +1,108 @@
+#include "../Common/CdrFormat.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+// Read-only mapping of a whole file, unmapped on every return path. The descriptor is closed once mapped.
+struct Mapping {
+    explicit Mapping (const std::string& path) {
+        const int fd = open (path.c_str (), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return;
+        struct stat st{};
+        if (fstat (fd, &st) == 0) {
+            size   = static_cast<std::size_t> (st.st_size);
+            opened = true;
+            if (size >= sizeof (Common::CdrFileHeader)) {
+                void* base = mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (base != MAP_FAILED)
+                    data = base;
+            }
+        }
+        const int err = errno;
+        close (fd);
+        errno         = err;
+    }
+
+    ~Mapping () {
+        if (data)
+            munmap (data, size);
+    }
+
+    Mapping (const Mapping&) = delete;
+
+    Mapping& operator= (const Mapping&) = delete;
+
+    void* data       = nullptr;
+    std::size_t size = 0;
+    bool opened      = false; // fstat succeeded
+};
+} // namespace
+
+// Converts a binary CDR segment back to the "ts, imsi, action" text format.
+// Usage: cdr_convert [--millis] <segment> [output]   (output defaults to stdout)
+int main (int argc, char* argv[]) {
+    bool millis = false;
+    std::string input, output;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp (argv[i], "--millis") == 0) {
+            millis = true;
+        } else if (input.empty ()) {
+            input = argv[i];
+        } else {
+            output = argv[i];
+        }
+    }
+    if (input.empty ()) {
+        std::cerr << "usage: " << argv[0] << " [--millis] <segment> [output]\n";
+        return 2;
+    }
+
+    const Mapping file (input);
+    if (!file.opened) {
+        std::cerr << "cannot open " << input << ": " << std::strerror (errno) << '\n';
+        return 1;
+    }
+    const std::size_t size = file.size;
+    if (size < sizeof (Common::CdrFileHeader)) {
+        std::cerr << input << ": too short for a binary CDR segment\n";
+        return 1;
+    }
+    if (!file.data) {
+        std::cerr << "cannot map " << input << ": " << std::strerror (errno) << '\n';
+        return 1;
+    }
+    madvise (file.data, size, MADV_SEQUENTIAL);
+
+    const auto* header = static_cast<const Common::CdrFileHeader*> (file.data);
+    if (!header->valid ()) {
+        std::cerr << input << ": not a binary CDR segment\n";
+        return 1;
+    }
+    const auto* records     = reinterpret_cast<const Common::CdrRecord*> (header + 1);
+    const std::size_t count = (size - sizeof *header) / sizeof (Common::CdrRecord);
+    if ((size - sizeof *header) % sizeof (Common::CdrRecord) != 0)
+        std::cerr << input << ": ignoring a truncated trailing record\n";
+
+    FILE* out = output.empty () ? stdout : std::fopen (output.c_str (), "w");
+    if (!out) {
+        std::cerr << "cannot create " << output << ": " << std::strerror (errno) << '\n';
+        return 1;
+    }
+    Common::TimestampCache timestamps (millis);
+    char line[Common::MAX_CDR_LINE];
+    for (std::size_t i = 0; i < count; ++i)
+        std::fwrite (line, 1, Common::format_cdr_line (records[i], timestamps, line), out);
+
+    const bool ok = std::fflush (out) == 0 && !std::ferror (out);
+    if (out != stdout)
+        std::fclose (out);
+    return ok ? 0 : 1;
+}
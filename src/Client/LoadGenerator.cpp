@@ -0,0 +1,295 @@
+#include "LoadGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+#include "../Common/Clock.h"
+#include "../Common/Imsi.h"
+#include "UdpClient.h"
+#include "spdlog/fmt/fmt.h"
+
+namespace {
+// Fresh IMSIs are MCC 250, MNC 99 and a 10-digit counter; every "prefix*" rule is sampled this many times.
+constexpr uint64_t FRESH_IMSI_SPACE     = 10'000'000'000;
+constexpr std::size_t PREFIX_SAMPLES    = 64;
+constexpr int SOCKET_BUFFER_BYTES       = 4 << 20;
+constexpr int64_t START_DELAY_NS        = 10'000'000;
+constexpr std::size_t MAX_ANSWER_LENGTH = 64;
+
+// Non-blocking UDP socket connected to server, or -1.
+int open_socket (const sockaddr_in& server) {
+    const int fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd == -1)
+        return -1;
+    setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER_BYTES, sizeof (SOCKET_BUFFER_BYTES));
+    if (connect (fd, reinterpret_cast<const sockaddr*> (&server), sizeof (server)) == -1) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+} // namespace
+
+struct client::LoadGenerator::Worker {
+    enum class Kind : uint8_t { fresh, repeat, blacklisted };
+
+    struct Request {
+        int64_t scheduled_ns;
+        uint32_t index; // into pool, or into _blacklisted
+        Kind kind;
+        bool active = false;
+    };
+
+    std::vector<pollfd> sockets;
+    std::vector<Request> in_flight; // per socket
+    std::vector<uint32_t> idle;     // sockets without a request in flight
+    std::vector<Encoded> pool;      // never sent IMSIs, used in order
+    std::size_t next_fresh = 0;
+    std::vector<uint32_t> confirmed; // pool indices answered "created"
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> mix{ 0.0, 1.0 };
+    Common::Histogram latency;
+    LoadReport report;
+
+    ~Worker () {
+        for (const auto& s : sockets)
+            if (s.fd != -1)
+                close (s.fd);
+    }
+};
+
+client::LoadGenerator::LoadGenerator (const Common::ClientSettings& settings, LoadOptions options)
+: _options (std::move (options)) {
+    if (!(_options.rate > 0) || !(_options.duration_sec > 0) || _options.threads == 0 || _options.sockets == 0)
+        throw std::invalid_argument ("Load rate, duration, threads and sockets must be positive");
+    if (_options.repeat_ratio < 0 || _options.blacklisted_ratio < 0 ||
+    _options.repeat_ratio + _options.blacklisted_ratio > 1)
+        throw std::invalid_argument ("Repeat and blacklisted ratios must add up to at most 1");
+    if (_options.blacklisted_ratio > 0 && _options.blacklisted.empty ())
+        throw std::invalid_argument ("Blacklisted ratio set without blacklisted IMSIs");
+
+    _server.sin_family = AF_INET;
+    _server.sin_port   = htons (settings.server_port);
+    if (inet_aton (settings.server_ip.c_str (), &_server.sin_addr) == 0)
+        throw std::invalid_argument ("Bad server ip in config: " + settings.server_ip);
+
+    std::mt19937_64 rng (_options.seed ? _options.seed : std::random_device{}());
+    _base = rng () % FRESH_IMSI_SPACE;
+    std::uniform_int_distribution<int> digit (0, 9);
+    for (const auto& entry : _options.blacklisted) {
+        if (entry.empty () || entry.back () != '*') {
+            _blacklisted.push_back (encode (entry));
+            continue;
+        }
+        for (std::size_t i = 0; i < PREFIX_SAMPLES; ++i) {
+            std::string imsi = entry.substr (0, entry.size () - 1);
+            while (imsi.size () < Common::Imsi::MAX_DIGITS)
+                imsi += static_cast<char> ('0' + digit (rng));
+            _blacklisted.push_back (encode (imsi));
+        }
+    }
+}
+
+client::LoadGenerator::Encoded client::LoadGenerator::encode (const std::string& imsi) {
+    if (!Common::Imsi::from_string (imsi).valid ())
+        throw std::invalid_argument ("Bad IMSI for load: " + imsi);
+    const auto bcd = UdpClient::imsi_to_bcd (imsi);
+    Encoded e;
+    std::copy (bcd.begin (), bcd.end (), e.bcd.begin ());
+    e.len = static_cast<uint8_t> (bcd.size ());
+    return e;
+}
+
+client::LoadReport client::LoadGenerator::run () const {
+    const auto threads     = _options.threads;
+    const auto interval_ns = std::max<int64_t> (1, std::llround (1e9 * static_cast<double> (threads) / _options.rate));
+    const auto duration_ns = std::llround (_options.duration_sec * 1e9);
+    const auto per_thread  = static_cast<std::size_t> (duration_ns / interval_ns + 1);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+        auto w = std::make_unique<Worker> ();
+        w->rng.seed (_base + t);
+        // Thread t owns every threads-th IMSI of the run, so threads never share one.
+        w->pool.reserve (per_thread);
+        for (std::size_t i = 0; i < per_thread; ++i)
+            w->pool.push_back (encode (fmt::format ("25099{:010}", (_base + i * threads + t) % FRESH_IMSI_SPACE)));
+        w->in_flight.resize (_options.sockets);
+        for (std::size_t s = 0; s < _options.sockets; ++s) {
+            const int fd = open_socket (_server);
+            if (fd == -1)
+                throw std::runtime_error ("Failed to open UDP socket");
+            w->sockets.push_back ({ fd, POLLIN, 0 });
+            w->idle.push_back (static_cast<uint32_t> (_options.sockets - 1 - s));
+        }
+        workers.push_back (std::move (w));
+    }
+
+    const int64_t start_ns = Common::steady_now_ns () + START_DELAY_NS;
+    std::vector<std::thread> senders;
+    for (std::size_t t = 0; t < threads; ++t)
+        senders.emplace_back ([&, t] {
+            // Threads are staggered across one interval so the combined schedule stays evenly spaced.
+            const int64_t offset = interval_ns * static_cast<int64_t> (t) / static_cast<int64_t> (threads);
+            run_worker (*workers[t], start_ns + offset, start_ns + duration_ns, interval_ns);
+        });
+    for (auto& th : senders)
+        th.join ();
+
+    LoadReport total;
+    total.seconds     = _options.duration_sec;
+    total.target_rate = _options.rate;
+    for (const auto& w : workers) {
+        const auto& r = w->report;
+        total.sent += r.sent;
+        total.answered += r.answered;
+        total.lost += r.lost;
+        total.send_errors += r.send_errors;
+        total.no_socket += r.no_socket;
+        total.created += r.created;
+        total.existing += r.existing;
+        total.rejected += r.rejected;
+        total.unexpected += r.unexpected;
+        total.latency += w->latency.snapshot ();
+    }
+    return total;
+}
+
+void client::LoadGenerator::run_worker (Worker& worker,
+const int64_t start_ns,
+const int64_t end_ns,
+const int64_t interval_ns) const {
+    const int64_t timeout_ns = int64_t{ _options.timeout_ms } * 1'000'000;
+    int64_t next_ns          = start_ns;
+    char answer[MAX_ANSWER_LENGTH];
+
+    while (true) {
+        int64_t now = Common::steady_now_ns ();
+        // Requests that fell behind schedule go out at once; their latency still counts from the schedule.
+        for (; next_ns < end_ns && next_ns <= now; next_ns += interval_ns)
+            send_next (worker, next_ns);
+
+        int64_t wake_ns = next_ns < end_ns ? next_ns : INT64_MAX;
+        bool waiting    = false;
+        for (std::size_t s = 0; s < worker.sockets.size (); ++s) {
+            auto& req = worker.in_flight[s];
+            if (!req.active)
+                continue;
+            if (now - req.scheduled_ns <= timeout_ns) {
+                waiting = true;
+                wake_ns = std::min (wake_ns, req.scheduled_ns + timeout_ns + 1);
+                continue;
+            }
+            // A late answer must not be taken for the next request's, so the socket is replaced by a new one.
+            ++worker.report.lost;
+            req.active = false;
+            close (worker.sockets[s].fd);
+            worker.sockets[s].fd = open_socket (_server);
+            if (worker.sockets[s].fd != -1)
+                worker.idle.push_back (static_cast<uint32_t> (s));
+        }
+        if (next_ns >= end_ns && !waiting)
+            break;
+
+        const int64_t wait = std::max<int64_t> (0, wake_ns - now);
+        const timespec ts{ static_cast<time_t> (wait / 1'000'000'000), static_cast<long> (wait % 1'000'000'000) };
+        if (ppoll (worker.sockets.data (), worker.sockets.size (), &ts, nullptr) <= 0)
+            continue;
+        for (std::size_t s = 0; s < worker.sockets.size (); ++s) {
+            if (!(worker.sockets[s].revents & POLLIN))
+                continue;
+            ssize_t n;
+            while ((n = recv (worker.sockets[s].fd, answer, sizeof (answer), MSG_DONTWAIT)) > 0)
+                on_answer (worker, s, { answer, static_cast<std::size_t> (n) }, Common::steady_now_ns ());
+        }
+    }
+}
+
+void client::LoadGenerator::send_next (Worker& worker, const int64_t scheduled_ns) const {
+    if (worker.idle.empty ()) {
+        ++worker.report.no_socket;
+        return;
+    }
+    using Kind     = Worker::Kind;
+    const double r = worker.mix (worker.rng);
+    Worker::Request req{ scheduled_ns, 0, Kind::fresh, true };
+    if (r < _options.blacklisted_ratio) {
+        req.kind  = Kind::blacklisted;
+        req.index = static_cast<uint32_t> (worker.rng () % _blacklisted.size ());
+    } else if (r < _options.blacklisted_ratio + _options.repeat_ratio && !worker.confirmed.empty ()) {
+        req.kind  = Kind::repeat;
+        req.index = worker.confirmed[worker.rng () % worker.confirmed.size ()];
+    } else {
+        req.index = static_cast<uint32_t> (worker.next_fresh++);
+    }
+
+    const auto socket   = worker.idle.back ();
+    const Encoded& imsi = req.kind == Kind::blacklisted ? _blacklisted[req.index] : worker.pool[req.index];
+    if (send (worker.sockets[socket].fd, imsi.bcd.data (), imsi.len, MSG_DONTWAIT) != imsi.len) {
+        ++worker.report.send_errors;
+        return;
+    }
+    ++worker.report.sent;
+    worker.idle.pop_back ();
+    worker.in_flight[socket] = req;
+}
+
+// Answers carry no request id, so a socket carries one request at a time and its answer is the one in flight on it.
+// The server may drop a request without answering; its socket is then only reused once the request times out.
+void client::LoadGenerator::on_answer (Worker& worker,
+const std::size_t socket,
+const std::string_view answer,
+const int64_t now_ns) {
+    auto& in_flight = worker.in_flight[socket];
+    if (!in_flight.active)
+        return;
+    const auto req   = in_flight;
+    in_flight.active = false;
+    worker.idle.push_back (static_cast<uint32_t> (socket));
+
+    auto& r = worker.report;
+    ++r.answered;
+    worker.latency.record (static_cast<uint64_t> (std::max<int64_t> (0, now_ns - req.scheduled_ns)));
+
+    std::string_view expected;
+    switch (req.kind) {
+    case Worker::Kind::fresh: expected = "created"; break;
+    case Worker::Kind::repeat: expected = "exists"; break;
+    case Worker::Kind::blacklisted: expected = "rejected"; break;
+    }
+    if (answer == "created")
+        ++r.created;
+    else if (answer == "exists")
+        ++r.existing;
+    else if (answer == "rejected")
+        ++r.rejected;
+    if (answer != expected)
+        ++r.unexpected;
+    // Only IMSIs whose session is known to exist are repeated, so "exists" never races the creating request.
+    if (req.kind == Worker::Kind::fresh && answer == "created")
+        worker.confirmed.push_back (req.index);
+}
+
+void client::LoadGenerator::print (const LoadReport& report, std::ostream& out) {
+    const auto per_second = [&] (const uint64_t n) { return static_cast<double> (n) / report.seconds; };
+    const auto percent    = [&] (const uint64_t n) {
+        return report.sent ? 100.0 * static_cast<double> (n) / static_cast<double> (report.sent) : 0.0;
+    };
+    const auto us = [&] (const double q) { return static_cast<double> (report.latency.quantile (q)) * 1e-3; };
+
+    out << fmt::format ("sent        {} ({:.0f} req/s, target {:.0f})\n", report.sent, per_second (report.sent),
+    report.target_rate);
+    out << fmt::format ("answered    {} ({:.0f} req/s)\n", report.answered, per_second (report.answered));
+    out << fmt::format ("lost        {} ({:.3f}%), send errors {}, no free socket {}\n", report.lost,
+    percent (report.lost), report.send_errors, report.no_socket);
+    out << fmt::format ("outcomes    created {}, exists {}, rejected {}, unexpected {}\n", report.created,
+    report.existing, report.rejected, report.unexpected);
+    out << fmt::format ("latency us  p50 {:.1f}, p90 {:.1f}, p99 {:.1f}, p99.9 {:.1f}, max {:.1f}\n", us (0.5),
+    us (0.9), us (0.99), us (0.999), us (1.0));
+}
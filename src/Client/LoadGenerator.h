@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../Common/ConfigLoader.h"
+#include "../Common/Histogram.h"
+#include "arpa/inet.h"
+
+namespace client {
+struct LoadOptions {
+    double rate              = 10'000; // requests per second, all threads together
+    double duration_sec      = 10;
+    std::size_t threads      = 1;
+    std::size_t sockets      = 64;  // per thread; each carries one request at a time, so this caps requests in flight
+    double repeat_ratio      = 0.5; // requests for an IMSI that already has a session
+    double blacklisted_ratio = 0;   // requests for an IMSI from blacklisted
+    std::vector<std::string> blacklisted; // IMSIs or "prefix*" rules blacklisted on the server
+    uint32_t timeout_ms = 1000; // a request unanswered for this long is lost
+    uint64_t seed       = 0;    // 0 = random
+};
+
+struct LoadReport {
+    uint64_t sent{};
+    uint64_t answered{};
+    uint64_t lost{};
+    uint64_t send_errors{};
+    uint64_t no_socket{}; // not sent: every socket of the thread had a request in flight
+    uint64_t created{};
+    uint64_t existing{};
+    uint64_t rejected{};
+    uint64_t unexpected{}; // answer differs from the outcome the request was built for
+    double seconds{};      // length of the send schedule
+    double target_rate{};
+    Common::Histogram::Snapshot latency; // ns from the scheduled send time to the answer
+};
+
+// Open-loop load: every thread sends on a fixed schedule whether or not earlier requests were answered, and a
+// request's latency counts from its scheduled send time, so a stalled server shows up as latency instead of
+// silently slowing the senders down (coordinated omission). IMSIs are generated before the clock starts.
+class LoadGenerator {
+    public:
+    LoadGenerator (const Common::ClientSettings& settings, LoadOptions options);
+
+    LoadReport run () const;
+
+    static void print (const LoadReport& report, std::ostream& out);
+
+    private:
+    struct Encoded {
+        std::array<uint8_t, 8> bcd{};
+        uint8_t len{};
+    };
+
+    struct Worker;
+
+    static Encoded encode (const std::string& imsi);
+
+    void run_worker (Worker& worker, int64_t start_ns, int64_t end_ns, int64_t interval_ns) const;
+
+    void send_next (Worker& worker, int64_t scheduled_ns) const;
+
+    static void on_answer (Worker& worker, std::size_t socket, std::string_view answer, int64_t now_ns);
+
+    sockaddr_in _server{};
+    LoadOptions _options;
+    std::vector<Encoded> _blacklisted;
+    uint64_t _base;
+};
+} // namespace client
@@ -49,18 +49,6 @@ class UdpClient {
         return ss.str ();
     }
 
-    private:
-    static constexpr size_t MAX_EVENTS_EPOLL = 16;
-    static constexpr size_t MAX_BUFFER_SIZE  = 1024;
-
-    int _udp_fd{ -1 };
-    int _epoll_fd{ -1 };
-
-    std::string _server_ip;
-    uint16_t _server_port;
-    std::shared_ptr<spdlog::logger> _logger;
-
-
     static std::vector<uint8_t> imsi_to_bcd (const std::string& imsi_in) {
         std::vector<uint8_t> bcd;
         std::string imsi = imsi_in;
@@ -79,5 +67,16 @@ class UdpClient {
         }
         return bcd;
     }
+
+    private:
+    static constexpr size_t MAX_EVENTS_EPOLL = 16;
+    static constexpr size_t MAX_BUFFER_SIZE  = 1024;
+
+    int _udp_fd{ -1 };
+    int _epoll_fd{ -1 };
+
+    std::string _server_ip;
+    uint16_t _server_port;
+    std::shared_ptr<spdlog::logger> _logger;
 };
 } // namespace client
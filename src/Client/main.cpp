@@ -1,12 +1,61 @@
 #include "../Common/ConfigLoader.h"
+#include "LoadGenerator.h"
 #include "UdpClient.h"
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
+static std::vector<std::string> read_lines (const char* path) {
+    std::ifstream in (path);
+    if (!in)
+        throw std::runtime_error (std::string ("Cannot open ") + path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline (in, line);) {
+        line.erase (line.find_last_not_of (" \t\r") + 1);
+        if (!line.empty () && line.front () != '#')
+            lines.push_back (line);
+    }
+    return lines;
+}
+
+static int run_load (const Common::ClientSettings& settings, int argc, char* argv[]) {
+    client::LoadOptions options;
+    for (int i = 2; i < argc; ++i) {
+        const std::string_view flag = argv[i];
+        if (i + 1 >= argc)
+            throw std::invalid_argument ("Missing value for " + std::string (flag));
+        const char* value = argv[++i];
+        if (flag == "--rate")
+            options.rate = std::stod (value);
+        else if (flag == "--duration")
+            options.duration_sec = std::stod (value);
+        else if (flag == "--threads")
+            options.threads = std::stoul (value);
+        else if (flag == "--sockets")
+            options.sockets = std::stoul (value);
+        else if (flag == "--repeat")
+            options.repeat_ratio = std::stod (value);
+        else if (flag == "--blacklisted")
+            options.blacklisted_ratio = std::stod (value);
+        else if (flag == "--blacklist-file")
+            options.blacklisted = read_lines (value);
+        else if (flag == "--timeout-ms")
+            options.timeout_ms = std::stoul (value);
+        else
+            throw std::invalid_argument ("Unknown load option " + std::string (flag));
+    }
+    const client::LoadGenerator generator (settings, options);
+    client::LoadGenerator::print (generator.run (), std::cout);
+    return 0;
+}
+
 int main (int argc, char* argv[]) {
     try {
         const auto settings = Common::SettingsLoader::load<Common::ClientSettings> ("CLIENT_SETTINGS");
-        std::size_t count   = 1;
+        if (argc > 1 && std::strcmp (argv[1], "--load") == 0)
+            return run_load (settings, argc, argv);
+
+        std::size_t count = 1;
         std::string forced_imsi;
 
         for (int i = 1; i < argc; ++i) {
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "BlockedBloom.h"
+#include "Imsi.h"
+
+namespace Common {
+// Inclusive range of packed IMSI values. Packed IMSIs sort like their digit strings, so every IMSI starting with a
+// given MCC/MNC (or any other digit prefix) falls into one range.
+struct ImsiRange {
+    uint64_t first;
+    uint64_t last;
+
+    constexpr bool contains (const Imsi& imsi) const {
+        return imsi.raw () >= first && imsi.raw () <= last;
+    }
+};
+
+// "25099*" -> range of every IMSI starting with 25099. Returns nothing unless the text is 1-15 digits and a '*'.
+constexpr std::optional<ImsiRange> parse_imsi_prefix (const std::string_view text) {
+    if (text.size () < 2 || text.size () > Imsi::MAX_DIGITS + 1 || text.back () != '*')
+        return std::nullopt;
+    uint64_t digits = 0;
+    for (std::size_t i = 0; i + 1 < text.size (); ++i) {
+        if (text[i] < '0' || text[i] > '9')
+            return std::nullopt;
+        digits |= static_cast<uint64_t> (text[i] - '0') << (60 - 4 * i);
+    }
+    const unsigned free_bits = 64 - 4 * static_cast<unsigned> (text.size () - 1);
+    return ImsiRange{ digits, digits | ((uint64_t{ 1 } << free_bits) - 1) };
+}
+
+// Sorts ranges and merges overlapping or adjacent ones, so membership is one binary search.
+inline void normalize_ranges (std::vector<ImsiRange>& ranges) {
+    std::sort (
+    ranges.begin (), ranges.end (), [] (const ImsiRange& a, const ImsiRange& b) { return a.first < b.first; });
+    std::size_t out = 0;
+    for (const auto& r : ranges) {
+        if (out > 0 && (r.first <= ranges[out - 1].last || r.first - 1 == ranges[out - 1].last)) {
+            ranges[out - 1].last = std::max (ranges[out - 1].last, r.last);
+        } else {
+            ranges[out++] = r;
+        }
+    }
+    ranges.resize (out);
+}
+
+inline bool ranges_contain (const ImsiRange* ranges, const std::size_t count, const Imsi& imsi) {
+    const auto* it = std::upper_bound (
+    ranges, ranges + count, imsi.raw (), [] (const uint64_t v, const ImsiRange& r) { return v < r.first; });
+    return it != ranges && (it - 1)->contains (imsi);
+}
+
+// Branchless lower-bound search over a sorted array: the loop compiles to conditional moves, with both possible
+// next probes prefetched, so a lookup in tens of millions of keys costs a few cache misses and no mispredictions.
+inline bool sorted_contains (const uint64_t* keys, std::size_t count, const uint64_t key) {
+    if (count == 0)
+        return false;
+    const uint64_t* base = keys;
+    while (count > 1) {
+        const std::size_t half = count / 2;
+        __builtin_prefetch (base + half / 2);
+        __builtin_prefetch (base + half + half / 2);
+        base = base[half] <= key ? base + half : base;
+        count -= half;
+    }
+    return *base == key;
+}
+
+// Binary blacklist file (host byte order), built offline by blacklist_build and mmapped by BlackListStorer:
+//   BlacklistFileHeader | bloom_blocks x BloomBlock | imsi_count x uint64_t (sorted Imsi::raw ()) |
+//   range_count x ImsiRange (sorted, merged)
+// The header is 64 bytes so the Bloom blocks stay cache-line aligned in the mapping.
+struct BlacklistFileHeader {
+    static constexpr char MAGIC[8]    = { 'P', 'G', 'W', 'B', 'L', 'K', '\0', '\0' };
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved0;
+    uint64_t bloom_blocks;
+    uint64_t imsi_count;
+    uint64_t range_count;
+    uint64_t reserved[3];
+
+    bool valid () const {
+        return std::memcmp (magic, MAGIC, sizeof magic) == 0 && version == VERSION
+        && std::has_single_bit (bloom_blocks);
+    }
+
+    std::size_t file_size () const {
+        return sizeof (BlacklistFileHeader) + bloom_blocks * sizeof (BloomBlock) + imsi_count * sizeof (uint64_t)
+        + range_count * sizeof (ImsiRange);
+    }
+};
+
+static_assert (sizeof (BlacklistFileHeader) == 64 && std::is_trivially_copyable_v<BlacklistFileHeader>);
+static_assert (sizeof (ImsiRange) == 16);
+
+// Writes a blacklist file; imsis and ranges are sorted, de-duplicated and merged here.
+inline bool write_blacklist_file (const char* path, std::vector<uint64_t> imsis, std::vector<ImsiRange> ranges) {
+    std::sort (imsis.begin (), imsis.end ());
+    imsis.erase (std::unique (imsis.begin (), imsis.end ()), imsis.end ());
+    normalize_ranges (ranges);
+
+    BlacklistFileHeader header{};
+    std::memcpy (header.magic, BlacklistFileHeader::MAGIC, sizeof header.magic);
+    header.version      = BlacklistFileHeader::VERSION;
+    header.bloom_blocks = bloom_block_count (imsis.size (), 0);
+    header.imsi_count   = imsis.size ();
+    header.range_count  = ranges.size ();
+
+    std::vector<BloomBlock> bloom (header.bloom_blocks, BloomBlock{});
+    for (const auto raw : imsis)
+        bloom_add (bloom.data (), bloom.size (), std::hash<Imsi>{}(Imsi::from_raw (raw)));
+
+    FILE* out = std::fopen (path, "wb");
+    if (!out)
+        return false;
+    bool ok = std::fwrite (&header, sizeof header, 1, out) == 1;
+    ok      = ok && std::fwrite (bloom.data (), sizeof (BloomBlock), bloom.size (), out) == bloom.size ();
+    ok      = ok && std::fwrite (imsis.data (), sizeof (uint64_t), imsis.size (), out) == imsis.size ();
+    ok      = ok && std::fwrite (ranges.data (), sizeof (ImsiRange), ranges.size (), out) == ranges.size ();
+    return std::fclose (out) == 0 && ok;
+}
+} // namespace Common
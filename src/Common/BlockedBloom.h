@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace Common {
+// Blocked Bloom filter over 64-byte blocks: a key sets one bit in each of the 8 words of a single cache line, so a
+// lookup touches one block and checks all probes with one masked compare. Keys are 64-bit hashes; the block comes
+// from the high 32 bits, the bit positions from the low 32. The block count is a power of two.
+struct alignas (64) BloomBlock {
+    uint64_t words[8];
+};
+
+constexpr std::size_t BLOOM_BITS_PER_KEY = 16;
+
+inline std::size_t bloom_block_count (const std::size_t entries, const std::size_t min_bits) {
+    const std::size_t bits = std::max (min_bits, entries * BLOOM_BITS_PER_KEY);
+    return std::bit_ceil (std::max<std::size_t> ((bits + 511) / 512, 1));
+}
+
+inline BloomBlock bloom_probe_mask (const uint64_t hash) {
+    static constexpr uint32_t SALT[8] = { 0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U,
+        0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+    const auto key = static_cast<uint32_t> (hash);
+    BloomBlock mask;
+    for (std::size_t i = 0; i < 8; ++i)
+        mask.words[i] = uint64_t{ 1 } << ((key * SALT[i]) >> 26);
+    return mask;
+}
+
+inline void bloom_add (BloomBlock* blocks, const std::size_t block_count, const uint64_t hash) {
+    auto& block     = blocks[(hash >> 32) & (block_count - 1)];
+    const auto mask = bloom_probe_mask (hash);
+    for (std::size_t i = 0; i < 8; ++i)
+        block.words[i] |= mask.words[i];
+}
+
+inline bool bloom_test (const BloomBlock* blocks, const std::size_t block_count, const uint64_t hash) {
+    const auto& block = blocks[(hash >> 32) & (block_count - 1)];
+    const auto mask   = bloom_probe_mask (hash);
+#if defined(__AVX2__)
+    const auto* b = reinterpret_cast<const __m256i*> (block.words);
+    const auto* m = reinterpret_cast<const __m256i*> (mask.words);
+    // testc: (~block & mask) == 0, i.e. every probed bit is set.
+    return _mm256_testc_si256 (_mm256_load_si256 (b), _mm256_load_si256 (m))
+    & _mm256_testc_si256 (_mm256_load_si256 (b + 1), _mm256_load_si256 (m + 1));
+#elif defined(__SSE2__)
+    const auto* b   = reinterpret_cast<const __m128i*> (block.words);
+    const auto* m   = reinterpret_cast<const __m128i*> (mask.words);
+    __m128i missing = _mm_setzero_si128 ();
+    for (std::size_t i = 0; i < 4; ++i)
+        missing = _mm_or_si128 (missing, _mm_andnot_si128 (_mm_load_si128 (b + i), _mm_load_si128 (m + i)));
+    return _mm_movemask_epi8 (_mm_cmpeq_epi8 (missing, _mm_setzero_si128 ())) == 0xFFFF;
+#else
+    uint64_t missing = 0;
+    for (std::size_t i = 0; i < 8; ++i)
+        missing |= mask.words[i] & ~block.words[i];
+    return missing == 0;
+#endif
+}
+
+// Expected false-positive rate. A key lands in a block with Poisson(n / blocks) other keys; a block holding j keys
+// has each of its 8 words filled to 1 - (63/64)^j, and a false positive needs the probed bit set in all 8.
+inline double bloom_fpr (const std::size_t entries, const std::size_t block_count) {
+    const double lambda = static_cast<double> (entries) / static_cast<double> (block_count);
+    double p            = std::exp (-lambda);
+    double fpr          = 0;
+    for (std::size_t j = 0; j < 64 + static_cast<std::size_t> (lambda * 8); ++j) {
+        fpr += p * std::pow (1 - std::pow (63.0 / 64.0, static_cast<double> (j)), 8);
+        p *= lambda / static_cast<double> (j + 1);
+    }
+    return fpr;
+}
+} // namespace Common
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+#include "Imsi.h"
+#include "Timestamp.h"
+
+namespace Common {
+enum class CdrAction : uint8_t { created, rejected, timeout, offload, removed };
+
+constexpr std::string_view to_string (const CdrAction action) {
+    switch (action) {
+    case CdrAction::created: return "created";
+    case CdrAction::rejected: return "rejected";
+    case CdrAction::timeout: return "timeout";
+    case CdrAction::offload: return "offload";
+    case CdrAction::removed: return "removed";
+    }
+    return "unknown";
+}
+
+// Binary CDR segment: one CdrFileHeader followed by CdrRecords, host byte order. Both are 32 bytes, so a mapped
+// segment can be scanned as a CdrRecord array starting right after the header.
+struct CdrFileHeader {
+    static constexpr char MAGIC[8]    = { 'P', 'G', 'W', 'C', 'D', 'R', '\0', '\0' };
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    int64_t created_ns;
+    uint64_t reserved;
+
+    bool valid () const;
+};
+
+struct CdrRecord {
+    int64_t epoch_ns;
+    uint64_t imsi;
+    // Per-writer sequence number, gap-free within one server run.
+    uint64_t sequence;
+    // Session table shard of the IMSI.
+    uint16_t shard;
+    CdrAction action;
+    uint8_t reserved[5];
+};
+
+static_assert (sizeof (CdrFileHeader) == 32 && std::is_trivially_copyable_v<CdrFileHeader>);
+static_assert (sizeof (CdrRecord) == 32 && std::is_trivially_copyable_v<CdrRecord>);
+
+inline bool CdrFileHeader::valid () const {
+    return std::memcmp (magic, MAGIC, sizeof magic) == 0 && version == VERSION && record_size == sizeof (CdrRecord);
+}
+
+inline CdrFileHeader make_cdr_header (const int64_t created_ns) {
+    CdrFileHeader header{};
+    std::memcpy (header.magic, CdrFileHeader::MAGIC, sizeof header.magic);
+    header.version     = CdrFileHeader::VERSION;
+    header.record_size = sizeof (CdrRecord);
+    header.created_ns  = created_ns;
+    return header;
+}
+
+// Longest text line format_cdr_line can produce: millisecond timestamp, 15 digits, longest action, separators.
+constexpr std::size_t MAX_CDR_LINE = 64;
+
+// Renders "<ts>, <imsi>, <action>\n" into out (at least MAX_CDR_LINE bytes) and returns its length.
+inline std::size_t format_cdr_line (const CdrRecord& record, TimestampCache& timestamps, char* out) {
+    const auto ts     = timestamps.format (record.epoch_ns);
+    const auto action = to_string (record.action);
+    std::size_t len   = ts.copy (out, ts.size ());
+    out[len++]        = ',';
+    out[len++]        = ' ';
+    len += Imsi::from_raw (record.imsi).format_to (out + len);
+    out[len++] = ',';
+    out[len++] = ' ';
+    len += action.copy (out + len, action.size ());
+    out[len++] = '\n';
+    return len;
+}
+} // namespace Common
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace Common {
+// steady_clock as plain nanoseconds, for timestamps carried in packets and lock-free counters.
+inline int64_t steady_now_ns () {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (
+    std::chrono::steady_clock::now ().time_since_epoch ())
+    .count ();
+}
+} // namespace Common
@@ -2,22 +2,86 @@
 
 #include <fstream>
 #include <unordered_set>
+#include <vector>
 
 #include "nlohmann/json.hpp"
 #include "spdlog/sinks/basic_file_sink.h"
 #include "spdlog/spdlog.h"
 
+#include "Timestamp.h"
+
 namespace Common {
 struct ServerSettings {
     std::string udp_ip{};
     size_t udp_port{};
     size_t session_timeout_sec{};
     std::string cdr_file = "cdr.log";
-    size_t http_port;
-    size_t graceful_shutdown_rate;
+    size_t http_port{};
+    // Worker threads of the HTTP control plane.
+    size_t http_threads = 4;
+    // Sessions per second removed by a graceful shutdown (0 = none, stop at once), spread over ticks this long.
+    size_t graceful_shutdown_rate{};
+    size_t graceful_offload_tick_us = 500;
     std::string log_file                = "pgw.log";
     spdlog::level::level_enum log_level = spdlog::level::trace;
     std::unordered_set<std::string> blacklist;
+    // Number of SO_REUSEPORT data plane shards, each with its own socket, epoll and worker threads.
+    size_t udp_shards = 1;
+    // CPUs the shards are pinned to (shard i -> udp_shard_cpus[i % size]); empty means no pinning.
+    std::vector<int> udp_shard_cpus;
+    // Datagrams per recvmmsg/sendmmsg call; 1 keeps the recvfrom/sendto path.
+    size_t udp_batch_size = 1;
+    // Longest time a partially filled response batch waits before sendmmsg.
+    size_t udp_flush_timeout_us = 50;
+    // "epoll", or "io_uring" (multishot recvmsg into provided buffers, sendmsg SQEs batched by udp_batch_size);
+    // shards fall back to epoll on kernels without io_uring.
+    std::string udp_io_backend = "epoll";
+    // "staged": receive, process and send on three threads per shard linked by lock-free queues. "run_to_completion":
+    // one thread per shard does all three on the same socket (epoll backend only).
+    std::string udp_pipeline = "staged";
+    // Admission control per shard: datagrams/s allowed per source address with bursts up to admission_source_burst
+    // (rate 0 = off), tracked in a table of admission_source_table addresses. Each shard keeps its own buckets, so a
+    // source spreading over several sockets may get up to udp_shards times the rate. Once the recv queue holds
+    // admission_queue_watermark packets (0 = off, at most 4096), only refreshes of known sessions are accepted.
+    size_t admission_source_rate     = 0;
+    size_t admission_source_burst    = 100;
+    size_t admission_source_table    = 4096;
+    size_t admission_queue_watermark = 3072;
+    // Lock stripes of the session table, rounded up to a power of two.
+    size_t session_shards = 64;
+    // How often expired sessions are swept; a session outlives session_timeout_sec by at most this much.
+    size_t session_timeout_granularity_ms = 1000;
+    // The CDR writer appends once this many bytes are buffered, or once the oldest buffered record is this old.
+    size_t cdr_flush_bytes       = 64 * 1024;
+    size_t cdr_flush_interval_ms = 100;
+    // fdatasync the CDR file at most this often after writes; 0 leaves durability to the page cache.
+    size_t cdr_fsync_interval_ms = 0;
+    // Adds milliseconds to CDR timestamps.
+    bool cdr_timestamp_millis = false;
+    // Rotate the CDR file once it reaches this size or age; 0 disables either trigger.
+    size_t cdr_rotate_bytes        = 0;
+    size_t cdr_rotate_interval_sec = 0;
+    // Compression of rotated CDR segments: "none" or "gzip".
+    std::string cdr_compression = "none";
+    // "text" lines or fixed-width "binary" records (see Common/CdrFormat.h, converted back by cdr_convert).
+    std::string cdr_format = "text";
+    // Extra blacklist entries: text with one IMSI or "prefix*" per line, or a blacklist_build binary that is mmapped.
+    // Re-read when the file changes (polled at the interval, 0 = only on POST /reload_blacklist). Entries from
+    // "blacklist" above stay in effect.
+    std::string blacklist_file;
+    size_t blacklist_poll_interval_ms = 1000;
+    // With a PGW_ENABLE_TRACING build, log the per-stage breakdown of requests answered slower than this; 0 = off.
+    size_t trace_slow_us = 0;
+    // Warm restart: sessions are snapshotted to this file every interval and restored from it on startup; empty
+    // disables both. With the journal on, attaches and detaches between snapshots are appended to
+    // <session_snapshot_file>.journal every flush interval and replayed on top of the snapshot. The appends reach
+    // the page cache only, so the journal survives a process crash but not a host crash or power loss, unless
+    // session_journal_fsync makes every flush fdatasync the journal (a host crash then loses one flush interval).
+    std::string session_snapshot_file;
+    size_t session_snapshot_interval_sec     = 60;
+    bool session_journal                     = false;
+    size_t session_journal_flush_interval_ms = 100;
+    bool session_journal_fsync               = false;
 };
 
 struct ClientSettings {
@@ -27,7 +91,7 @@ struct ClientSettings {
     spdlog::level::level_enum log_level = spdlog::level::trace;
 };
 
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE (ServerSettings, udp_ip, udp_port, session_timeout_sec, cdr_file, http_port, graceful_shutdown_rate, log_file, log_level, blacklist)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT (ServerSettings, udp_ip, udp_port, session_timeout_sec, cdr_file, http_port, http_threads, graceful_shutdown_rate, graceful_offload_tick_us, log_file, log_level, blacklist, udp_shards, udp_shard_cpus, udp_batch_size, udp_flush_timeout_us, udp_io_backend, udp_pipeline, admission_source_rate, admission_source_burst, admission_source_table, admission_queue_watermark, session_shards, session_timeout_granularity_ms, cdr_flush_bytes, cdr_flush_interval_ms, cdr_fsync_interval_ms, cdr_timestamp_millis, cdr_rotate_bytes, cdr_rotate_interval_sec, cdr_compression, cdr_format, blacklist_file, blacklist_poll_interval_ms, trace_slow_us, session_snapshot_file, session_snapshot_interval_sec, session_journal, session_journal_flush_interval_ms, session_journal_fsync)
 
 NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE (ClientSettings, server_ip, server_port, log_file, log_level)
 
@@ -65,6 +129,9 @@ make_file_logger (const TypeSettings& settings, const std::string& logger_name,
     log_path /= file_name;
     auto file_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt> (log_path.string (), true);
     auto logger    = std::make_shared<spdlog::logger> (logger_name, file_sink);
+    auto formatter = std::make_unique<spdlog::pattern_formatter> ();
+    formatter->add_flag<IsoTimestampFlag> ('*').set_pattern ("[%*] [%n] [%l] %v");
+    logger->set_formatter (std::move (formatter));
     logger->set_level (settings.log_level);
     return logger;
 }
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include "spdlog/fmt/fmt.h"
+
+namespace Common {
+// HDR-style log-linear histogram of non-negative integers (nanoseconds here): values below 32 get exact buckets,
+// larger ones 16 sub-buckets per power of two, so any recorded value is known to within 1/16 (~6%).
+// One writer per histogram: record () is a couple of relaxed loads and stores, no locked instruction. Readers take
+// a Snapshot at any time and merge snapshots of several writers.
+class Histogram {
+    public:
+    static constexpr unsigned SUB_BITS   = 4;
+    static constexpr uint64_t SUB_COUNT  = uint64_t{ 1 } << SUB_BITS;
+    static constexpr std::size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    static constexpr std::size_t bucket_of (const uint64_t value) {
+        const unsigned msb   = 63 - std::countl_zero (value | 1);
+        const unsigned shift = msb > SUB_BITS ? msb - SUB_BITS : 0;
+        return shift * SUB_COUNT + (value >> shift);
+    }
+
+    // Smallest and largest value that land in bucket.
+    static constexpr uint64_t bucket_low (const std::size_t bucket) {
+        if (bucket < 2 * SUB_COUNT)
+            return bucket;
+        const auto shift = static_cast<unsigned> (bucket / SUB_COUNT - 1);
+        return (bucket - shift * SUB_COUNT) << shift;
+    }
+
+    static constexpr uint64_t bucket_high (const std::size_t bucket) {
+        return bucket + 1 < BUCKETS ? bucket_low (bucket + 1) - 1 : UINT64_MAX;
+    }
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKETS> counts{};
+        uint64_t count = 0;
+        uint64_t sum   = 0;
+
+        Snapshot& operator+= (const Snapshot& other) {
+            for (std::size_t i = 0; i < BUCKETS; ++i)
+                counts[i] += other.counts[i];
+            count += other.count;
+            sum += other.sum;
+            return *this;
+        }
+
+        // Upper edge of the bucket holding the q-quantile; 0 when empty.
+        uint64_t quantile (const double q) const {
+            const auto rank = static_cast<uint64_t> (q * static_cast<double> (count) + 0.5);
+            uint64_t seen   = 0;
+            for (std::size_t i = 0; i < BUCKETS; ++i) {
+                seen += counts[i];
+                if (seen >= std::max<uint64_t> (rank, 1))
+                    return bucket_high (i);
+            }
+            return 0;
+        }
+
+        // Observations <= limit; exact when limit + 1 is a bucket edge (any power of two is).
+        uint64_t count_at_most (const uint64_t limit) const {
+            uint64_t n = 0;
+            for (std::size_t i = 0; i <= bucket_of (limit); ++i)
+                n += counts[i];
+            return n;
+        }
+    };
+
+    void record (const uint64_t value) {
+        bump (_counts[bucket_of (value)], 1);
+        bump (_sum, value);
+    }
+
+    Snapshot snapshot () const {
+        Snapshot s;
+        for (std::size_t i = 0; i < BUCKETS; ++i) {
+            s.counts[i] = _counts[i].load (std::memory_order_relaxed);
+            s.count += s.counts[i];
+        }
+        s.sum = _sum.load (std::memory_order_relaxed);
+        return s;
+    }
+
+    private:
+    static void bump (std::atomic<uint64_t>& counter, const uint64_t n) {
+        counter.store (counter.load (std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> _counts{};
+    std::atomic<uint64_t> _sum{ 0 };
+};
+
+// Prometheus text exposition of nanosecond histograms in seconds, with power-of-two bucket edges from min_ns to
+// max_ns (bucket edges of Histogram, so the cumulative counts are exact). labels, if any, are 'key="value"' pairs
+// distinguishing several series of one family; the family header goes first, once.
+inline void append_prometheus_header (std::string& out, const std::string_view name, const std::string_view help) {
+    fmt::format_to (std::back_inserter (out), "# HELP {} {}\n# TYPE {} histogram\n", name, help, name);
+}
+
+inline void append_prometheus_series (std::string& out,
+const std::string_view name,
+const std::string_view labels,
+const Histogram::Snapshot& snapshot,
+const uint64_t min_ns = uint64_t{ 1 } << 10,
+const uint64_t max_ns = uint64_t{ 1 } << 30) {
+    auto it                    = std::back_inserter (out);
+    const std::string_view sep = labels.empty () ? "" : ",";
+    for (uint64_t le = min_ns; le <= max_ns; le *= 2)
+        fmt::format_to (it, "{}_bucket{{{}{}le=\"{:.9g}\"}} {}\n", name, labels, sep, static_cast<double> (le) * 1e-9,
+        snapshot.count_at_most (le - 1));
+    fmt::format_to (it, "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, sep, snapshot.count);
+    if (labels.empty ())
+        fmt::format_to (it, "{}_sum {:.9f}\n{}_count {}\n", name, static_cast<double> (snapshot.sum) * 1e-9, name,
+        snapshot.count);
+    else
+        fmt::format_to (it, "{}_sum{{{}}} {:.9f}\n{}_count{{{}}} {}\n", name, labels,
+        static_cast<double> (snapshot.sum) * 1e-9, name, labels, snapshot.count);
+}
+
+inline void append_prometheus_histogram (std::string& out,
+const std::string_view name,
+const std::string_view help,
+const Histogram::Snapshot& snapshot) {
+    append_prometheus_header (out, name, help);
+    append_prometheus_series (out, name, {}, snapshot);
+}
+} // namespace Common
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "spdlog/fmt/fmt.h"
+
+namespace Common {
+// IMSI of up to 15 digits packed into 64 bits: digits as nibbles from bit 63 downwards, digit count in the low
+// nibble. Packed values sort like the digit strings, so an MCC/MNC prefix covers one contiguous range.
+class Imsi {
+    public:
+    static constexpr std::size_t MAX_DIGITS = 15;
+
+    constexpr Imsi () = default;
+
+    static constexpr Imsi from_raw (const uint64_t raw) {
+        Imsi imsi;
+        imsi._raw = raw;
+        return imsi;
+    }
+
+    // Wire format: two digits per byte, low nibble first, 0xF as filler. Returns an invalid Imsi on bad input.
+    static constexpr Imsi from_bcd (const uint8_t* data, const std::size_t len) {
+        uint64_t raw      = 0;
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < len; ++i) {
+            const uint8_t nibbles[2] = { static_cast<uint8_t> (data[i] & 0x0F), static_cast<uint8_t> (data[i] >> 4) };
+            for (const uint8_t nibble : nibbles) {
+                if (nibble == 0x0F)
+                    continue;
+                if (nibble > 9 || count == MAX_DIGITS)
+                    return {};
+                raw |= static_cast<uint64_t> (nibble) << (60 - 4 * count++);
+            }
+        }
+        return from_raw (raw | count);
+    }
+
+    static constexpr Imsi from_string (const std::string_view digits) {
+        if (digits.empty () || digits.size () > MAX_DIGITS)
+            return {};
+        uint64_t raw = 0;
+        for (std::size_t i = 0; i < digits.size (); ++i) {
+            if (digits[i] < '0' || digits[i] > '9')
+                return {};
+            raw |= static_cast<uint64_t> (digits[i] - '0') << (60 - 4 * i);
+        }
+        return from_raw (raw | digits.size ());
+    }
+
+    constexpr bool valid () const {
+        return length () != 0;
+    }
+
+    constexpr std::size_t length () const {
+        return _raw & 0x0F;
+    }
+
+    constexpr uint64_t raw () const {
+        return _raw;
+    }
+
+    constexpr uint8_t digit (const std::size_t i) const {
+        return (_raw >> (60 - 4 * i)) & 0x0F;
+    }
+
+    // Writes length () characters without a terminator and returns how many were written.
+    std::size_t format_to (char* out) const {
+        const std::size_t n = length ();
+        for (std::size_t i = 0; i < n; ++i)
+            out[i] = static_cast<char> ('0' + digit (i));
+        return n;
+    }
+
+    std::string to_string () const {
+        char buf[MAX_DIGITS];
+        return { buf, format_to (buf) };
+    }
+
+    constexpr auto operator<=> (const Imsi&) const = default;
+
+    private:
+    uint64_t _raw = 0;
+};
+
+inline std::ostream& operator<< (std::ostream& os, const Imsi& imsi) {
+    char buf[Imsi::MAX_DIGITS];
+    return os.write (buf, static_cast<std::streamsize> (imsi.format_to (buf)));
+}
+} // namespace Common
+
+template <> struct std::hash<Common::Imsi> {
+    std::size_t operator() (const Common::Imsi& imsi) const noexcept {
+        // murmur3 finalizer: packed digits differ mostly in the high bits, buckets are picked from the low ones.
+        uint64_t h = imsi.raw ();
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+template <> struct fmt::formatter<Common::Imsi> : fmt::formatter<std::string_view> {
+    auto format (const Common::Imsi& imsi, fmt::format_context& ctx) const {
+        char buf[Common::Imsi::MAX_DIGITS];
+        return fmt::formatter<std::string_view>::format (std::string_view{ buf, imsi.format_to (buf) }, ctx);
+    }
+};
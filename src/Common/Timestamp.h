@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <string_view>
+
+#include "spdlog/pattern_formatter.h"
+
+namespace Common {
+// ISO-8601 UTC timestamps ("2025-01-31T23:59:59Z", or "...59.123Z" with millis). The date and time of day are
+// re-rendered only when the second changes; milliseconds are patched in place. Not thread-safe: one per thread.
+class TimestampCache {
+    public:
+    static constexpr std::size_t SECONDS_LENGTH = 20;
+    static constexpr std::size_t MILLIS_LENGTH  = 24;
+
+    explicit TimestampCache (const bool millis = false) : _millis (millis) {
+    }
+
+    std::string_view format (const std::chrono::system_clock::time_point tp) {
+        return format (std::chrono::duration_cast<std::chrono::nanoseconds> (tp.time_since_epoch ()).count ());
+    }
+
+    std::string_view format (const int64_t epoch_ns) {
+        constexpr int64_t ns_per_sec = 1'000'000'000;
+        int64_t second               = epoch_ns / ns_per_sec;
+        int64_t rest                 = epoch_ns % ns_per_sec;
+        if (rest < 0) {
+            --second;
+            rest += ns_per_sec;
+        }
+        if (second != _second)
+            render (second);
+        if (!_millis) {
+            _buf[19] = 'Z';
+            return { _buf, SECONDS_LENGTH };
+        }
+        const auto ms = static_cast<int> (rest / 1'000'000);
+        _buf[19]      = '.';
+        _buf[20]      = static_cast<char> ('0' + ms / 100);
+        _buf[21]      = static_cast<char> ('0' + ms / 10 % 10);
+        _buf[22]      = static_cast<char> ('0' + ms % 10);
+        _buf[23]      = 'Z';
+        return { _buf, MILLIS_LENGTH };
+    }
+
+    private:
+    void render (const int64_t second) {
+        const auto t = static_cast<std::time_t> (second);
+        std::tm tm{};
+        gmtime_r (&t, &tm);
+        std::strftime (_buf, sizeof _buf, "%Y-%m-%dT%H:%M:%S", &tm);
+        _second = second;
+    }
+
+    const bool _millis;
+    int64_t _second = std::numeric_limits<int64_t>::min ();
+    char _buf[MILLIS_LENGTH + 1]{};
+};
+
+// spdlog flag rendering the message time through a TimestampCache; sinks serialise formatting, so one cache per
+// formatter clone is enough.
+class IsoTimestampFlag final : public spdlog::custom_flag_formatter {
+    public:
+    void format (const spdlog::details::log_msg& msg, const std::tm&, spdlog::memory_buf_t& dest) override {
+        const auto ts = _cache.format (msg.time);
+        dest.append (ts.data (), ts.data () + ts.size ());
+    }
+
+    std::unique_ptr<custom_flag_formatter> clone () const override {
+        return std::make_unique<IsoTimestampFlag> ();
+    }
+
+    private:
+    TimestampCache _cache{ true };
+};
+} // namespace Common
@@ -0,0 +1,40 @@
+#include "AdaptiveWaiter.h"
+
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace Pgw;
+
+AdaptiveWaiter::AdaptiveWaiter (const std::size_t spins, const std::size_t yields)
+: _spins (spins), _yields (yields), _event_fd (eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (_event_fd == -1)
+        throw std::runtime_error ("eventfd() failed");
+}
+
+AdaptiveWaiter::~AdaptiveWaiter () {
+    if (_event_fd != -1)
+        close (_event_fd);
+}
+
+void AdaptiveWaiter::notify () {
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (!_parked.load (std::memory_order_relaxed))
+        return;
+    constexpr uint64_t one = 1;
+    [[maybe_unused]] const ssize_t rc = write (_event_fd, &one, sizeof one);
+}
+
+void AdaptiveWaiter::park (const std::chrono::microseconds park_for) {
+    _parks.fetch_add (1, std::memory_order_relaxed);
+
+    pollfd pfd{ _event_fd, POLLIN, 0 };
+    const auto secs = std::chrono::duration_cast<std::chrono::seconds> (park_for);
+    const timespec timeout{ static_cast<time_t> (secs.count ()),
+        static_cast<long> (std::chrono::duration_cast<std::chrono::nanoseconds> (park_for - secs).count ()) };
+    if (ppoll (&pfd, 1, &timeout, nullptr) > 0) {
+        uint64_t value;
+        [[maybe_unused]] const ssize_t rc = read (_event_fd, &value, sizeof value);
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace Pgw {
+// Consumer-side wait for a single-consumer queue: spin, then yield, then park on an eventfd until a producer
+// calls notify () or the park timeout expires.
+class AdaptiveWaiter {
+    public:
+    explicit AdaptiveWaiter (std::size_t spins = 256, std::size_t yields = 16);
+
+    ~AdaptiveWaiter ();
+
+    AdaptiveWaiter (const AdaptiveWaiter&) = delete;
+
+    AdaptiveWaiter& operator= (const AdaptiveWaiter&) = delete;
+
+    // Repeats try_consume () until it succeeds (returns true) or the consumer has been parked for park_for.
+    template <typename TryConsume> bool wait (TryConsume&& try_consume, std::chrono::microseconds park_for);
+
+    // Producer side: wakes the consumer if it is parked. Costs one relaxed load when it is not.
+    void notify ();
+
+    std::size_t parks () const {
+        return _parks.load (std::memory_order_relaxed);
+    }
+
+    private:
+    static void cpu_relax () {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause ();
+#elif defined(__aarch64__)
+        asm volatile ("yield");
+#endif
+    }
+
+    void park (std::chrono::microseconds park_for);
+
+    const std::size_t _spins;
+    const std::size_t _yields;
+    int _event_fd = -1;
+    std::atomic<bool> _parked{ false };
+    std::atomic<std::size_t> _parks{ 0 };
+};
+
+template <typename TryConsume>
+bool AdaptiveWaiter::wait (TryConsume&& try_consume, const std::chrono::microseconds park_for) {
+    for (std::size_t i = 0; i < _spins; ++i) {
+        if (try_consume ())
+            return true;
+        cpu_relax ();
+    }
+    for (std::size_t i = 0; i < _yields; ++i) {
+        if (try_consume ())
+            return true;
+        std::this_thread::yield ();
+    }
+
+    // Announce the park before the last check; pairs with the fence in notify () so a push is never missed.
+    _parked.store (true, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (try_consume ()) {
+        _parked.store (false, std::memory_order_relaxed);
+        return true;
+    }
+    park (park_for);
+    _parked.store (false, std::memory_order_relaxed);
+    return try_consume ();
+}
+} // namespace Pgw
@@ -1,57 +1,244 @@
 #include "BlackListStorer.h"
 
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
 #include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+// Global so versions never repeat across instances; the thread-local reader cache relies on that.
+std::atomic<uint64_t> g_snapshot_versions{ 0 };
+} // namespace
+
+BlackListStorer::MappedFile::MappedFile (void* base, const std::size_t size)
+: base (base), size (size), header (static_cast<const Common::BlacklistFileHeader*> (base)),
+  bloom (reinterpret_cast<const Common::BloomBlock*> (header + 1)),
+  imsis (reinterpret_cast<const uint64_t*> (bloom + header->bloom_blocks)),
+  ranges (reinterpret_cast<const Common::ImsiRange*> (imsis + header->imsi_count)) {
+}
+
+BlackListStorer::MappedFile::~MappedFile () {
+    munmap (base, size);
+}
+
+bool BlackListStorer::Source::add (const std::string_view entry) {
+    if (const auto range = Common::parse_imsi_prefix (entry)) {
+        ranges.push_back (*range);
+        return true;
+    }
+    const auto imsi = Common::Imsi::from_string (entry);
+    if (!imsi.valid ())
+        return false;
+    entries.insert (imsi);
+    return true;
+}
+
+bool BlackListStorer::Snapshot::contains (const Common::Imsi& imsi) const {
+    if (!ranges.empty () && Common::ranges_contain (ranges.data (), ranges.size (), imsi))
+        return true;
+    const uint64_t h = std::hash<Common::Imsi>{}(imsi);
+    if (Common::bloom_test (blocks.data (), blocks.size (), h) && entries.contains (imsi))
+        return true;
+    return mapped && Common::bloom_test (mapped->bloom, mapped->header->bloom_blocks, h)
+    && Common::sorted_contains (mapped->imsis, mapped->header->imsi_count, imsi.raw ());
+}
 
 BlackListStorer::BlackListStorer (const std::size_t bloom_size, const std::shared_ptr<spdlog::logger>& logger)
-: _bloom (bloom_size, false), _logger (logger) {
+: _min_bits (bloom_size), _logger (logger) {
+    std::lock_guard lock (_reload_mutex);
+    publish ();
+}
+
+BlackListStorer::~BlackListStorer () {
+    {
+        std::lock_guard lock (_watch_mutex);
+        _watch_stop = true;
+    }
+    _watch_cv.notify_all ();
+    if (_watch_thread.joinable ())
+        _watch_thread.join ();
 }
 
 void BlackListStorer::store (const std::unordered_set<std::string>& black_list) {
-    _true_set = black_list;
-    for (const auto& s : black_list)
-        bloom_add (s);
-    _logger->info ("Blacklist loaded ({} entries)", black_list.size ());
+    Source configured;
+    for (const auto& s : black_list) {
+        if (!configured.add (s))
+            _logger->warn ("Skipping malformed blacklist entry '{}'", s);
+    }
+    std::lock_guard lock (_reload_mutex);
+    _configured = std::move (configured);
+    publish ();
 }
 
-bool BlackListStorer::is_in_blacklist (const std::string& imsi) const {
-    if (!bloom_test (imsi)) {
-        return false;
+bool BlackListStorer::watch (const std::filesystem::path& file, const std::chrono::milliseconds poll_interval) {
+    {
+        std::lock_guard lock (_reload_mutex);
+        _file = file;
     }
-    const bool hit = _true_set.contains (imsi);
+    // Stamped before the first read, so a change racing with it is picked up by the first poll.
+    const auto stamp  = file_stamp ();
+    const bool loaded = reload ();
+    if (poll_interval.count () > 0 && !_watch_thread.joinable ())
+        _watch_thread = std::thread (&BlackListStorer::watch_loop, this, poll_interval, stamp);
+    return loaded;
+}
+
+bool BlackListStorer::reload () {
+    std::lock_guard lock (_reload_mutex);
+    Source from_file;
+    if (_file.empty () || !read_file (from_file))
+        return false;
+    _from_file = std::move (from_file);
+    publish ();
+    return true;
+}
+
+bool BlackListStorer::has_source () const {
+    std::lock_guard lock (_reload_mutex);
+    return !_file.empty ();
+}
+
+std::size_t BlackListStorer::size () const {
+    const auto snapshot = _current.load ();
+    return snapshot->entries.size () + (snapshot->mapped ? snapshot->mapped->header->imsi_count : 0);
+}
+
+double BlackListStorer::bloom_fpr () const {
+    const auto snapshot = _current.load ();
+    return Common::bloom_fpr (snapshot->entries.size (), snapshot->blocks.size ());
+}
+
+bool BlackListStorer::is_in_blacklist (const Common::Imsi& imsi) const {
+    const bool hit = current ().contains (imsi);
     _logger->debug ("IMSI {} {}", imsi, hit ? "in blacklist" : "allowed");
     return hit;
 }
 
+const BlackListStorer::Snapshot& BlackListStorer::current () const {
+    struct Cache {
+        const BlackListStorer* owner = nullptr;
+        std::shared_ptr<const Snapshot> snapshot;
+    };
+    // Holding the reference here is the read-side critical section: an old snapshot lives until every thread
+    // that used it has looked the blacklist up again.
+    thread_local Cache cache;
+    const uint64_t version = _version.load (std::memory_order_acquire);
+    if (cache.owner != this || cache.snapshot->version != version) {
+        cache.owner    = this;
+        cache.snapshot = _current.load (std::memory_order_acquire);
+    }
+    return *cache.snapshot;
+}
+
+void BlackListStorer::publish () {
+    auto snapshot     = std::make_shared<Snapshot> ();
+    snapshot->version = g_snapshot_versions.fetch_add (1, std::memory_order_relaxed) + 1;
 
-void BlackListStorer::bloom_add (const std::string& s) {
-    const std::size_t h1 = hash1 (s);
-    const std::size_t h2 = hash2 (s) | 1;
-    for (std::size_t i = 0; i < K; ++i)
-        _bloom[(h1 + i * h2) % _bloom.size ()] = true;
+    snapshot->entries = _configured.entries;
+    snapshot->entries.insert (_from_file.entries.begin (), _from_file.entries.end ());
+    snapshot->blocks.assign (Common::bloom_block_count (snapshot->entries.size (), _min_bits), Common::BloomBlock{});
+    for (const auto& imsi : snapshot->entries)
+        Common::bloom_add (snapshot->blocks.data (), snapshot->blocks.size (), std::hash<Common::Imsi>{}(imsi));
+
+    snapshot->mapped = _from_file.mapped;
+    snapshot->ranges = _configured.ranges;
+    snapshot->ranges.insert (snapshot->ranges.end (), _from_file.ranges.begin (), _from_file.ranges.end ());
+    if (const auto& mapped = snapshot->mapped)
+        snapshot->ranges.insert (snapshot->ranges.end (), mapped->ranges, mapped->ranges + mapped->header->range_count);
+    Common::normalize_ranges (snapshot->ranges);
+
+    const auto entries = snapshot->entries.size ();
+    const auto mapped  = snapshot->mapped ? snapshot->mapped->header->imsi_count : 0;
+    const auto ranges  = snapshot->ranges.size ();
+    const auto kib     = snapshot->blocks.size () * sizeof (Common::BloomBlock) / 1024;
+    const double fpr   = Common::bloom_fpr (entries, snapshot->blocks.size ());
+    const auto version = snapshot->version;
+    _current.store (std::move (snapshot), std::memory_order_release);
+    _version.store (version, std::memory_order_release);
+    _logger->info ("Blacklist loaded ({} entries, {} mapped, {} prefix ranges; bloom {} KiB, expected false "
+                   "positives {:.4f}%)",
+    entries, mapped, ranges, kib, fpr * 100);
 }
 
-bool BlackListStorer::bloom_test (const std::string& s) const {
-    const std::size_t h1 = hash1 (s);
-    const std::size_t h2 = hash2 (s) | 1;
-    for (std::size_t i = 0; i < K; ++i)
-        if (!_bloom[(h1 + i * h2) % _bloom.size ()])
-            return false;
+bool BlackListStorer::read_file (Source& out) const {
+    std::ifstream in (_file, std::ios::binary);
+    if (!in) {
+        _logger->error ("Cannot read blacklist file {}", _file.string ());
+        return false;
+    }
+    char magic[sizeof Common::BlacklistFileHeader::MAGIC]{};
+    in.read (magic, sizeof magic);
+    if (in.gcount () == sizeof magic && std::equal (magic, magic + sizeof magic, Common::BlacklistFileHeader::MAGIC))
+        return map_file (out);
+
+    in.clear ();
+    in.seekg (0);
+    for (std::string line; std::getline (in, line);) {
+        std::string_view entry = line;
+        entry                  = entry.substr (0, entry.find ('#'));
+        const auto first       = entry.find_first_not_of (" \t\r");
+        if (first == std::string_view::npos)
+            continue;
+        entry = entry.substr (first, entry.find_last_not_of (" \t\r") - first + 1);
+        if (!out.add (entry))
+            _logger->warn ("Skipping malformed blacklist entry '{}' in {}", entry, _file.string ());
+    }
     return true;
 }
 
-std::size_t BlackListStorer::hash1 (const std::string& s) {
-    return std::hash<std::string>{}(s);
+bool BlackListStorer::map_file (Source& out) const {
+    // Older snapshots may still be reading the previous mapping, so binary files must be replaced by rename rather
+    // than rewritten in place.
+    const int fd = open (_file.c_str (), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd == -1 || fstat (fd, &st) == -1) {
+        if (fd != -1)
+            close (fd);
+        _logger->error ("Cannot open blacklist file {}", _file.string ());
+        return false;
+    }
+    const auto size = static_cast<std::size_t> (st.st_size);
+    void* base      = size >= sizeof (Common::BlacklistFileHeader)
+    ? mmap (nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+    : MAP_FAILED;
+    close (fd);
+    if (base == MAP_FAILED) {
+        _logger->error ("Cannot map blacklist file {}", _file.string ());
+        return false;
+    }
+    const auto* header = static_cast<const Common::BlacklistFileHeader*> (base);
+    if (!header->valid () || header->file_size () != size) {
+        _logger->error ("Blacklist file {} is corrupt or has an unsupported version", _file.string ());
+        munmap (base, size);
+        return false;
+    }
+    // Lookups hit one Bloom block and a handful of search probes; read-ahead would only pollute the page cache.
+    madvise (base, size, MADV_RANDOM);
+    out.mapped = std::make_shared<const MappedFile> (base, size);
+    return true;
 }
 
-std::size_t BlackListStorer::hash2 (const std::string& s) {
-    constexpr std::size_t mod = 7ULL * 10000000000ULL;
-    std::size_t hash          = 0;
-    std::size_t pow           = 1;
+BlackListStorer::FileStamp BlackListStorer::file_stamp () const {
+    std::lock_guard lock (_reload_mutex);
+    std::error_code mtime_ec, size_ec;
+    const auto mtime = std::filesystem::last_write_time (_file, mtime_ec);
+    const auto size  = std::filesystem::file_size (_file, size_ec);
+    return { mtime_ec ? std::filesystem::file_time_type{} : mtime, size_ec ? 0 : size };
+}
 
-    for (const char ch : s) {
-        constexpr std::size_t primary = 43;
-        hash                          = (hash + (ch - '0') * pow) % mod;
-        pow                           = (pow * primary) % mod;
+void BlackListStorer::watch_loop (const std::chrono::milliseconds poll_interval, FileStamp last) {
+    std::unique_lock lock (_watch_mutex);
+    while (!_watch_cv.wait_for (lock, poll_interval, [this] { return _watch_stop; })) {
+        const auto now = file_stamp ();
+        if (now == last)
+            continue;
+        last = now;
+        lock.unlock ();
+        _logger->info ("Blacklist file {} changed, reloading", _file.string ());
+        reload ();
+        lock.lock ();
     }
-    return hash;
 }
@@ -1,30 +1,134 @@
 #pragma once
+#include "../Common/BlacklistFormat.h"
+#include "../Common/BlockedBloom.h"
+#include "../Common/Imsi.h"
 #include "spdlog/logger.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+// The blacklist is an immutable snapshot published through an atomic shared_ptr. Reloads build a new snapshot off
+// the packet path and swap it in; readers keep a thread-local reference and only touch the shared pointer when the
+// published version changes, so is_in_blacklist never locks.
+//
+// Entries are IMSIs or digit prefixes ("25099*" blocks a whole MCC/MNC). Small lists live in memory; a binary file
+// from blacklist_build (see Common/BlacklistFormat.h) is mmapped instead, so tens of millions of IMSIs load
+// instantly and share the page cache.
 class BlackListStorer {
     public:
+    // bloom_size is the minimum in-memory filter size in bits; it grows to BLOOM_BITS_PER_KEY per entry if needed.
     explicit BlackListStorer (std::size_t bloom_size, const std::shared_ptr<spdlog::logger>& logger);
 
+    ~BlackListStorer ();
+
+    BlackListStorer (const BlackListStorer&) = delete;
+
+    BlackListStorer& operator= (const BlackListStorer&) = delete;
+
+    // Replaces the configured entries; entries read from the watched file, if any, are kept on top of them.
     void store (const std::unordered_set<std::string>& black_list);
 
-    bool is_in_blacklist (const std::string& imsi) const;
+    // Loads file now, then re-reads it whenever its size or mtime changes, checking every poll_interval (0 disables
+    // polling; reload () still works). The file is either a blacklist_build binary or text with one entry per line,
+    // where '#' starts a comment.
+    bool watch (const std::filesystem::path& file, std::chrono::milliseconds poll_interval);
+
+    // Re-reads the watched file. On failure the current blacklist stays in place.
+    bool reload ();
+
+    bool is_in_blacklist (const Common::Imsi& imsi) const;
+
+    bool has_source () const;
+
+    // Individual IMSIs, not counting prefix rules.
+    std::size_t size () const;
+
+    std::size_t range_count () const {
+        return _current.load ()->ranges.size ();
+    }
+
+    // In-memory Bloom filter; a mapped file brings its own.
+    std::size_t bloom_bytes () const {
+        return _current.load ()->blocks.size () * sizeof (Common::BloomBlock);
+    }
+
+    double bloom_fpr () const;
 
     private:
-    void bloom_add (const std::string& s);
+    struct MappedFile {
+        MappedFile (void* base, std::size_t size);
+
+        ~MappedFile ();
+
+        MappedFile (const MappedFile&) = delete;
+
+        MappedFile& operator= (const MappedFile&) = delete;
+
+        void* const base;
+        const std::size_t size;
+        const Common::BlacklistFileHeader* header;
+        const Common::BloomBlock* bloom;
+        const uint64_t* imsis;
+        const Common::ImsiRange* ranges;
+    };
+
+    struct Snapshot {
+        uint64_t version = 0;
+        std::vector<Common::BloomBlock> blocks;
+        std::unordered_set<Common::Imsi> entries;
+        std::vector<Common::ImsiRange> ranges;
+        std::shared_ptr<const MappedFile> mapped;
+
+        bool contains (const Common::Imsi& imsi) const;
+    };
+
+    // Everything one source (settings or file) contributes.
+    struct Source {
+        std::unordered_set<Common::Imsi> entries;
+        std::vector<Common::ImsiRange> ranges;
+        std::shared_ptr<const MappedFile> mapped;
+
+        // Parses an IMSI or "prefix*" entry; false if it is neither.
+        bool add (std::string_view entry);
+    };
+
+    const Snapshot& current () const;
+
+    // Builds and publishes a snapshot of _configured plus _from_file; callers hold _reload_mutex.
+    void publish ();
+
+    bool read_file (Source& out) const;
+
+    bool map_file (Source& out) const;
+
+    using FileStamp = std::pair<std::filesystem::file_time_type, std::uintmax_t>;
+
+    FileStamp file_stamp () const;
 
-    bool bloom_test (const std::string& s) const;
+    void watch_loop (std::chrono::milliseconds poll_interval, FileStamp last);
 
-    static std::size_t hash1 (const std::string& s);
+    const std::size_t _min_bits;
+    std::atomic<std::shared_ptr<const Snapshot> > _current;
+    std::atomic<uint64_t> _version{ 0 };
 
-    static std::size_t hash2 (const std::string& s);
+    mutable std::mutex _reload_mutex;
+    Source _configured;
+    Source _from_file;
+    std::filesystem::path _file;
 
-    static constexpr std::size_t K = 7;
+    std::mutex _watch_mutex;
+    std::condition_variable _watch_cv;
+    bool _watch_stop = false;
+    std::thread _watch_thread;
 
-    std::vector<bool> _bloom;
-    std::unordered_set<std::string> _true_set;
     std::shared_ptr<spdlog::logger> _logger;
 };
@@ -1,27 +1,116 @@
 #include "CdrWriter.h"
 
-#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
 #include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+#ifdef PGW_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "../Common/ConfigLoader.h"
 
+namespace {
+constexpr auto IDLE_PARK_TIMEOUT = std::chrono::milliseconds (100);
+
+int64_t epoch_ns () {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::system_clock::now ().time_since_epoch ())
+    .count ();
+}
+
+#ifdef PGW_HAVE_ZLIB
+// Writes <segment>.gz via a temporary name, then removes the plain segment.
+bool gzip_segment (const std::filesystem::path& segment) {
+    const std::string target = segment.string () + ".gz";
+    const std::string tmp    = target + ".tmp";
+    std::ifstream in (segment, std::ios::binary);
+    gzFile out = gzopen (tmp.c_str (), "wb");
+    if (!in || !out) {
+        if (out)
+            gzclose (out);
+        return false;
+    }
+
+    std::vector<char> buf (1 << 16);
+    bool ok = true;
+    while (ok && in) {
+        in.read (buf.data (), static_cast<std::streamsize> (buf.size ()));
+        const auto n = static_cast<int> (in.gcount ());
+        if (n > 0 && gzwrite (out, buf.data (), static_cast<unsigned> (n)) != n)
+            ok = false;
+    }
+    ok = gzclose (out) == Z_OK && ok;
+
+    std::error_code ec;
+    if (ok)
+        std::filesystem::rename (tmp, target, ec);
+    if (!ok || ec) {
+        std::filesystem::remove (tmp, ec);
+        return false;
+    }
+    std::filesystem::remove (segment, ec);
+    return true;
+}
+#endif
+} // namespace
+
 CdrWriter::CdrWriter (const Common::ServerSettings& settings, const std::shared_ptr<spdlog::logger>& logger)
-: _logger (logger) {
+: _flush_bytes (std::max<std::size_t> (settings.cdr_flush_bytes, 1)),
+  _flush_interval (settings.cdr_flush_interval_ms), _sync_interval (settings.cdr_fsync_interval_ms),
+  _rotate_bytes (settings.cdr_rotate_bytes), _rotate_interval (settings.cdr_rotate_interval_sec),
+  _binary (settings.cdr_format == "binary"), _header_bytes (_binary ? sizeof (Common::CdrFileHeader) : 0),
+  _timestamps (settings.cdr_timestamp_millis), _logger (logger) {
     const char* env = std::getenv ("PROJECT_DIR");
-    const std::filesystem::path cdr_path =
-    env ? std::filesystem::path{ env } / "logs" / settings.cdr_file : std::filesystem::path{ settings.cdr_file };
+    _path = env ? std::filesystem::path{ env } / "logs" / settings.cdr_file : std::filesystem::path{ settings.cdr_file };
+
+    if (settings.cdr_format != "text" && !_binary) {
+        throw std::runtime_error ("Unknown cdr_format: " + settings.cdr_format);
+    }
+    if (settings.cdr_compression == "gzip") {
+#ifdef PGW_HAVE_ZLIB
+        _compress = true;
+#else
+        throw std::runtime_error ("CDR gzip compression requested, but the server was built without zlib");
+#endif
+    } else if (settings.cdr_compression != "none") {
+        throw std::runtime_error ("Unknown cdr_compression: " + settings.cdr_compression);
+    }
 
-    _stream.open (cdr_path, std::ios::out | std::ios::app);
-    if (!_stream.is_open ()) {
+    if (!open_segment ()) {
         throw std::runtime_error ("Failed to open CDR file: " + settings.cdr_file);
     }
+    _buffer.reserve (_flush_bytes + Common::MAX_CDR_LINE);
+    _last_sync = std::chrono::steady_clock::now ();
+    _thread    = std::thread (&CdrWriter::run, this);
+    if (_compress)
+        _compress_thread = std::thread (&CdrWriter::compress_segments, this);
     _logger->info ("CDR writer started, file {}", settings.cdr_file);
 }
 
 CdrWriter::~CdrWriter () {
     try {
-        flush ();
-        _stream.close ();
+        _stopping.store (true);
+        _waiter.notify ();
+        if (_thread.joinable ())
+            _thread.join ();
+        {
+            std::lock_guard lock (_compress_mutex);
+            _compress_stop = true;
+        }
+        _compress_ready.notify_all ();
+        if (_compress_thread.joinable ())
+            _compress_thread.join ();
+        if (_fd != -1) {
+            if (_sync_interval.count () > 0)
+                fdatasync (_fd);
+            close (_fd);
+        }
         _logger->info ("CDR writer stopped");
     } catch (...) {
         if (_logger)
@@ -29,29 +118,219 @@ CdrWriter::~CdrWriter () {
     }
 }
 
-void CdrWriter::write (const std::string& imsi, const std::string& action) {
-    const std::string ts = _timestamp_iso_utc ();
-
-    std::lock_guard lock (_mutex);
-    _stream << ts << ", " << imsi << ", " << action << '\n';
-    if (!_stream.good ()) {
-        _logger->error ("Failed to write CDR for IMSI {} action {}", imsi, action);
+void CdrWriter::write (const Common::Imsi& imsi, const Common::CdrAction action, const uint16_t shard) {
+    Common::CdrRecord record{};
+    record.epoch_ns = epoch_ns ();
+    record.imsi     = imsi.raw ();
+    record.shard    = shard;
+    record.action   = action;
+    if (!_queue.push (record)) {
+        // Never dropped: the caller waits for the writer thread, counted once per write however long it spins.
+        _queue_full_stalls.fetch_add (1, std::memory_order_relaxed);
+        do {
+            _waiter.notify ();
+            std::this_thread::yield ();
+        } while (!_queue.push (record));
     }
-    _stream.flush ();
+    _enqueued.fetch_add (1);
+    _waiter.notify ();
 }
 
 void CdrWriter::flush () {
-    std::lock_guard lock (_mutex);
-    _stream.flush ();
+    const std::size_t target = _enqueued.load ();
+    std::unique_lock lock (_flush_mutex);
+    _flush_waiters.fetch_add (1);
+    _waiter.notify ();
+    _flushed.wait (lock, [&] { return _written.load () >= target; });
+    _flush_waiters.fetch_sub (1);
 }
 
-std::string CdrWriter::_timestamp_iso_utc () {
+void CdrWriter::run () {
     using namespace std::chrono;
-    const auto now   = system_clock::now ();
-    const auto now_t = system_clock::to_time_t (now);
+    bool unsynced = false;
+    while (true) {
+        // Sampled before draining: records pushed ahead of the stop request are always in the queue by now.
+        const bool stopping = _stopping.load ();
+        const bool drained  = drain ();
+
+        const auto now = steady_clock::now ();
+        if (_buffered > 0
+        && (stopping || _buffer.size () >= _flush_bytes || now - _first_buffered >= _flush_interval
+        || _flush_waiters.load () > 0)) {
+            write_out ();
+            unsynced = _sync_interval.count () > 0 && _fd != -1;
+        }
+        if (unsynced && now - _last_sync >= _sync_interval) {
+            if (fdatasync (_fd) == -1)
+                _logger->error ("CDR fdatasync failed: {}", std::strerror (errno));
+            _last_sync = now;
+            unsynced   = false;
+        }
+        if (rotation_due (now)) {
+            rotate ();
+            unsynced = false;
+        }
+        if (stopping && _buffered == 0 && _queue.empty ())
+            return;
+        if (drained)
+            continue;
+
+        auto park_for = duration_cast<microseconds> (IDLE_PARK_TIMEOUT);
+        if (_buffered > 0)
+            park_for = std::min (park_for, duration_cast<microseconds> (_first_buffered + _flush_interval - now));
+        if (unsynced)
+            park_for = std::min (park_for, duration_cast<microseconds> (_last_sync + _sync_interval - now));
+        if (_rotate_interval.count () > 0 && _segment_bytes > _header_bytes)
+            park_for = std::min (park_for, duration_cast<microseconds> (_segment_opened + _rotate_interval - now));
+        _waiter.wait (
+        [&] { return !_queue.empty () || _stopping.load () || (_buffered > 0 && _flush_waiters.load () > 0); },
+        std::max (park_for, microseconds (0)));
+    }
+}
+
+bool CdrWriter::drain () {
+    bool any = false;
+    Common::CdrRecord record{};
+    while (_buffer.size () < _flush_bytes && _queue.pop (record)) {
+        append (record);
+        any = true;
+    }
+    return any;
+}
+
+void CdrWriter::append (Common::CdrRecord& record) {
+    if (_buffered++ == 0)
+        _first_buffered = std::chrono::steady_clock::now ();
+
+    record.sequence = _sequence++;
+    if (_binary) {
+        _buffer.append (reinterpret_cast<const char*> (&record), sizeof record);
+        return;
+    }
+    char line[Common::MAX_CDR_LINE];
+    _buffer.append (line, Common::format_cdr_line (record, _timestamps, line));
+}
+
+void CdrWriter::write_out () {
+    if (_fd == -1 && !open_segment ()) {
+        // Dropped, not kept: the queue behind the buffer would fill and stall the data plane instead.
+        if (!std::exchange (_unwritable, true))
+            _logger->error ("Cannot open CDR file {}, dropping CDRs until it opens: {}", _path.string (),
+            std::strerror (errno));
+        _unwritten.fetch_add (_buffered, std::memory_order_relaxed);
+        _buffer.clear ();
+    } else if (std::exchange (_unwritable, false)) {
+        _logger->info ("CDR file {} reopened", _path.string ());
+    }
+    const char* data = _buffer.data ();
+    std::size_t left = _buffer.size ();
+    while (left > 0) {
+        const ssize_t rc = ::write (_fd, data, left);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            _logger->error ("Failed to write {} CDRs: {}", _buffered, std::strerror (errno));
+            break;
+        }
+        data += rc;
+        left -= static_cast<std::size_t> (rc);
+        _segment_bytes += static_cast<std::size_t> (rc);
+    }
+    _buffer.clear ();
+    // Pairs with flush (): either it sees the new count, or this thread sees its waiter and wakes it.
+    _written.fetch_add (std::exchange (_buffered, 0));
+    if (_flush_waiters.load () > 0) {
+        std::lock_guard lock (_flush_mutex);
+        _flushed.notify_all ();
+    }
+}
+
+bool CdrWriter::open_segment () {
+    _fd = ::open (_path.c_str (), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd == -1) {
+        _segment_bytes = 0;
+        return false;
+    }
+    struct stat st{};
+    _segment_bytes  = fstat (_fd, &st) == 0 ? static_cast<std::size_t> (st.st_size) : 0;
+    _segment_opened = std::chrono::steady_clock::now ();
+    if (!_binary)
+        return true;
+
+    Common::CdrFileHeader header{};
+    if (_segment_bytes == 0) {
+        header = Common::make_cdr_header (epoch_ns ());
+        if (::write (_fd, &header, sizeof header) == static_cast<ssize_t> (sizeof header)) {
+            _segment_bytes = sizeof header;
+            return true;
+        }
+    } else if (pread (_fd, &header, sizeof header, 0) == static_cast<ssize_t> (sizeof header) && header.valid ()) {
+        return true;
+    }
+    _logger->error ("CDR file {} is not a writable binary CDR segment", _path.string ());
+    close (_fd);
+    _fd            = -1;
+    _segment_bytes = 0;
+    return false;
+}
+
+bool CdrWriter::rotation_due (const std::chrono::steady_clock::time_point now) const {
+    if (_segment_bytes <= _header_bytes)
+        return false;
+    return (_rotate_bytes > 0 && _segment_bytes >= _rotate_bytes)
+    || (_rotate_interval.count () > 0 && now - _segment_opened >= _rotate_interval);
+}
+
+void CdrWriter::rotate () {
+    if (_sync_interval.count () > 0)
+        fdatasync (_fd);
+    close (_fd);
+
+    const auto segment = segment_name ();
+    std::error_code ec;
+    std::filesystem::rename (_path, segment, ec);
+    if (ec) {
+        _logger->error ("Failed to rotate CDR file {}: {}", _path.string (), ec.message ());
+    } else {
+        _rotations.fetch_add (1, std::memory_order_relaxed);
+        _logger->info ("CDR file rotated to {}", segment.string ());
+        if (_compress) {
+            std::lock_guard lock (_compress_mutex);
+            _compress_queue.push_back (segment);
+            _compress_ready.notify_one ();
+        }
+    }
+    if (!open_segment ())
+        _logger->error ("Failed to reopen CDR file {}: {}", _path.string (), std::strerror (errno));
+}
+
+std::filesystem::path CdrWriter::segment_name () const {
+    const auto now_t = std::chrono::system_clock::to_time_t (std::chrono::system_clock::now ());
     std::tm tm{};
     gmtime_r (&now_t, &tm);
-    std::ostringstream ss;
-    ss << std::put_time (&tm, "%Y-%m-%dT%H:%M:%SZ");
-    return ss.str ();
+    char stamp[32];
+    std::strftime (stamp, sizeof stamp, "%Y%m%dT%H%M%SZ", &tm);
+
+    const std::string base = _path.string () + '.' + stamp;
+    std::string candidate  = base;
+    for (int n = 1; std::filesystem::exists (candidate) || std::filesystem::exists (candidate + ".gz"); ++n)
+        candidate = base + '.' + std::to_string (n);
+    return candidate;
+}
+
+void CdrWriter::compress_segments () {
+    std::unique_lock lock (_compress_mutex);
+    while (true) {
+        _compress_ready.wait (lock, [&] { return _compress_stop || !_compress_queue.empty (); });
+        if (_compress_queue.empty ())
+            return;
+        const auto segment = std::move (_compress_queue.front ());
+        _compress_queue.pop_front ();
+        lock.unlock ();
+#ifdef PGW_HAVE_ZLIB
+        if (!gzip_segment (segment))
+            _logger->error ("Failed to compress CDR segment {}", segment.string ());
+#endif
+        lock.lock ();
+    }
 }
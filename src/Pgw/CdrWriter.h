@@ -1,18 +1,62 @@
 #pragma once
+#include "../Common/CdrFormat.h"
 #include "../Common/ConfigLoader.h"
+#include "../Common/Imsi.h"
+#include "../Common/Timestamp.h"
+#include "AdaptiveWaiter.h"
 #include "spdlog/spdlog.h"
-#include <fstream>
+#include <boost/lockfree/queue.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
 
+// Producers enqueue fixed-size records into a lock-free ring; a dedicated writer thread renders them and appends
+// whole batches with one write () each, flushing by size or age and optionally fdatasync-ing on an interval.
+// Records are appended as "ts, imsi, action" text lines or, with cdr_format = "binary", as Common::CdrRecords.
+// The writer thread also rotates the file by size or age (rename to <cdr_file>.<UTC stamp>); closed segments are
+// gzip-compressed on a separate thread so neither producers nor the writer wait for them.
 class CdrWriter {
     public:
+    static constexpr std::size_t QUEUE_CAPACITY = 32768;
+
     explicit CdrWriter (const Common::ServerSettings& settings, const std::shared_ptr<spdlog::logger>& logger);
 
     ~CdrWriter ();
 
-    void write (const std::string& imsi, const std::string& action);
+    void write (const Common::Imsi& imsi, Common::CdrAction action, uint16_t shard = 0);
 
+    // Blocks until every record enqueued before the call has been handed to the kernel.
     void flush ();
 
+    std::size_t written () const {
+        return _written.load (std::memory_order_relaxed);
+    }
+
+    // Records enqueued but not yet handed to the kernel.
+    std::size_t backlog () const {
+        const std::size_t written = _written.load (std::memory_order_relaxed);
+        const std::size_t queued  = _enqueued.load (std::memory_order_relaxed);
+        return queued > written ? queued - written : 0;
+    }
+
+    // write () calls that found the queue full and had to wait for the writer thread.
+    std::size_t queue_full_stalls () const {
+        return _queue_full_stalls.load (std::memory_order_relaxed);
+    }
+
+    // Records discarded because the CDR file could not be opened.
+    std::size_t unwritten () const {
+        return _unwritten.load (std::memory_order_relaxed);
+    }
+
+    std::size_t rotations () const {
+        return _rotations.load (std::memory_order_relaxed);
+    }
+
     CdrWriter (const CdrWriter&) = delete;
 
     CdrWriter& operator= (const CdrWriter&) = delete;
@@ -22,9 +66,65 @@ class CdrWriter {
     CdrWriter& operator= (CdrWriter&&) = delete;
 
     private:
-    std::ofstream _stream;
-    std::mutex _mutex;
-    std::shared_ptr<spdlog::logger> _logger;
+    void run ();
+
+    bool drain ();
+
+    void append (Common::CdrRecord& record);
+
+    void write_out ();
+
+    bool open_segment ();
 
-    static std::string _timestamp_iso_utc ();
+    bool rotation_due (std::chrono::steady_clock::time_point now) const;
+
+    void rotate ();
+
+    std::filesystem::path segment_name () const;
+
+    void compress_segments ();
+
+    int _fd = -1;
+    std::filesystem::path _path;
+    const std::size_t _flush_bytes;
+    const std::chrono::milliseconds _flush_interval;
+    const std::chrono::milliseconds _sync_interval;
+    const std::size_t _rotate_bytes;
+    const std::chrono::seconds _rotate_interval;
+    bool _compress = false;
+    const bool _binary;
+    const std::size_t _header_bytes;
+
+    boost::lockfree::queue<Common::CdrRecord, boost::lockfree::capacity<QUEUE_CAPACITY> > _queue;
+    Pgw::AdaptiveWaiter _waiter;
+
+    // Writer-thread state.
+    Common::TimestampCache _timestamps;
+    std::string _buffer;
+    std::size_t _buffered = 0;
+    uint64_t _sequence    = 0;
+    std::chrono::steady_clock::time_point _first_buffered;
+    std::chrono::steady_clock::time_point _last_sync;
+    std::size_t _segment_bytes = 0;
+    std::chrono::steady_clock::time_point _segment_opened;
+    bool _unwritable = false; // the last open failed; logged once until an open succeeds
+
+    std::atomic<std::size_t> _enqueued{ 0 };
+    std::atomic<std::size_t> _written{ 0 };
+    std::atomic<std::size_t> _queue_full_stalls{ 0 };
+    std::atomic<std::size_t> _unwritten{ 0 };
+    std::atomic<std::size_t> _rotations{ 0 };
+    std::atomic<std::size_t> _flush_waiters{ 0 };
+    std::atomic<bool> _stopping{ false };
+    std::mutex _flush_mutex;
+    std::condition_variable _flushed;
+
+    std::mutex _compress_mutex;
+    std::condition_variable _compress_ready;
+    std::deque<std::filesystem::path> _compress_queue;
+    bool _compress_stop = false;
+
+    std::thread _thread;
+    std::thread _compress_thread;
+    std::shared_ptr<spdlog::logger> _logger;
 };
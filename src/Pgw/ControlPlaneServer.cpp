@@ -1,12 +1,28 @@
 #include "ControlPlaneServer.h"
 #include "crow.h"
 #include "spdlog/spdlog.h"
+#include <algorithm>
+#include <charconv>
+#include <vector>
+
+namespace {
+// Absent parameters keep the default in out.
+bool parse_size (const char* text, std::size_t& out) {
+    if (!text)
+        return true;
+    const std::string_view s (text);
+    const auto [end, ec] = std::from_chars (s.data (), s.data () + s.size (), out);
+    return ec == std::errc{} && end == s.data () + s.size ();
+}
+} // namespace
 
 ControlPlaneServer::ControlPlaneServer (const Common::ServerSettings& settings,
 SessionManager& session_manager,
 StopCallback on_stop,
 const std::shared_ptr<spdlog::logger>& logger)
-: _http_port (settings.http_port), _session_mgr (session_manager), _on_stop (std::move (on_stop)), _logger (logger) {
+: _http_port (settings.http_port),
+  _http_threads (static_cast<uint16_t> (std::clamp<std::size_t> (settings.http_threads, 1, MAX_HTTP_THREADS))),
+  _session_mgr (session_manager), _on_stop (std::move (on_stop)), _logger (logger) {
 }
 
 ControlPlaneServer::~ControlPlaneServer () {
@@ -21,19 +37,177 @@ void ControlPlaneServer::start () {
         if (!imsi) {
             return crow::response (400, "Bad request: missing IMSI");
         }
-        const bool subscribed = _session_mgr.has_session (imsi);
+        const auto key = Common::Imsi::from_string (imsi);
+        if (!key.valid ()) {
+            return crow::response (400, "Bad request: malformed IMSI");
+        }
+        const bool subscribed = _session_mgr.has_session (key);
         return crow::response{ subscribed ? "active" : "not active" };
     });
 
+    CROW_ROUTE (_app, "/check_subscribers").methods (crow::HTTPMethod::POST) ([this] (const crow::request& req) {
+        const char* format = req.url_params.get ("format");
+        const bool bitmap  = format && std::string_view (format) == "bitmap";
+        auto body          = check_subscribers (_session_mgr, req.body, bitmap);
+        if (!body) {
+            return crow::response (413, "Too many IMSIs: at most " + std::to_string (MAX_BULK_IMSIS));
+        }
+        crow::response res (std::move (*body));
+        res.set_header ("Content-Type", bitmap ? "application/octet-stream" : "application/json");
+        return res;
+    });
+
+    CROW_ROUTE (_app, "/sessions").methods (crow::HTTPMethod::GET) ([this] (const crow::request& req) {
+        const char* cursor_text = req.url_params.get ("cursor");
+        const auto cursor       = cursor_text ? parse_cursor (cursor_text) : SessionCursor{};
+        std::size_t limit       = DEFAULT_SESSION_PAGE;
+        if (!cursor || !parse_size (req.url_params.get ("limit"), limit)) {
+            return crow::response (400, "Bad request: malformed cursor or limit");
+        }
+        crow::response res (dump_sessions (_session_mgr, *cursor, std::clamp<std::size_t> (limit, 1, MAX_SESSION_PAGE)));
+        res.set_header ("Content-Type", "application/json");
+        return res;
+    });
+
+    CROW_ROUTE (_app, "/metrics").methods (crow::HTTPMethod::GET) ([this] {
+        std::string body;
+        if (_metrics)
+            _metrics (body);
+        crow::response res (std::move (body));
+        res.set_header ("Content-Type", "text/plain; version=0.0.4");
+        return res;
+    });
+
+    CROW_ROUTE (_app, "/offload").methods (crow::HTTPMethod::GET) ([this] {
+        crow::response res (offload_status (_offload ? _offload () : Pgw::OffloadScheduler::Progress{}));
+        res.set_header ("Content-Type", "application/json");
+        return res;
+    });
+
     CROW_ROUTE (_app, "/stop").methods (crow::HTTPMethod::GET, crow::HTTPMethod::POST) ([this] (const crow::request& req) {
         _logger->info ("HTTP /stop requested — graceful shutdown initiated");
         _on_stop ();
         return crow::response ("Stopping");
     });
 
+    CROW_ROUTE (_app, "/reload_blacklist").methods (crow::HTTPMethod::POST) ([this] {
+        if (!_blacklist || !_blacklist->has_source ()) {
+            return crow::response (400, "No blacklist_file configured");
+        }
+        if (!_blacklist->reload ()) {
+            return crow::response (500, "Blacklist reload failed");
+        }
+        _logger->info ("HTTP /reload_blacklist: {} entries", _blacklist->size ());
+        return crow::response ("Blacklist reloaded: " + std::to_string (_blacklist->size ()) + " entries");
+    });
+
+    // has_session does not lock, so these threads never stall the packet workers on the session shards.
+    _workers.emplace_back ([this] { _app.port (_http_port).concurrency (_http_threads).run (); });
+}
+
+std::optional<std::string>
+ControlPlaneServer::check_subscribers (const SessionManager& sessions, const std::string_view body, const bool bitmap) {
+    static constexpr std::string_view SEPARATORS = " \t\r\n,[]\"";
+    std::string out;
+    out.reserve (bitmap ? body.size () / 64 + 1 : body.size () / 2);
+    if (!bitmap)
+        out.push_back ('[');
+    std::size_t count = 0;
+    for (std::size_t pos = body.find_first_not_of (SEPARATORS); pos != std::string_view::npos;
+    pos                  = body.find_first_not_of (SEPARATORS, pos)) {
+        const auto end  = std::min (body.find_first_of (SEPARATORS, pos), body.size ());
+        const auto imsi = Common::Imsi::from_string (body.substr (pos, end - pos));
+        pos             = end;
+        if (++count > MAX_BULK_IMSIS)
+            return std::nullopt;
+
+        const bool active = imsi.valid () && sessions.has_session (imsi);
+        if (bitmap) {
+            if (count % 8 == 1)
+                out.push_back ('\0');
+            out.back () = static_cast<char> (out.back () | active << ((count - 1) % 8));
+        } else {
+            if (count > 1)
+                out.push_back (',');
+            out += !imsi.valid () ? "null" : active ? "true" : "false";
+        }
+    }
+    if (!bitmap)
+        out.push_back (']');
+    return out;
+}
+
+std::optional<ControlPlaneServer::SessionCursor> ControlPlaneServer::parse_cursor (const std::string_view text) {
+    SessionCursor cursor;
+    const auto [end, ec] = std::from_chars (text.data (), text.data () + text.size (), cursor.shard);
+    if (ec != std::errc{})
+        return std::nullopt;
+    const std::string_view rest (end, text.data () + text.size () - end);
+    if (rest.empty ())
+        return cursor;
+    cursor.after = Common::Imsi::from_string (rest.substr (1));
+    if (rest.front () != ':' || !cursor.after.valid ())
+        return std::nullopt;
+    return cursor;
+}
+
+std::string
+ControlPlaneServer::dump_sessions (const SessionManager& sessions, SessionCursor cursor, const std::size_t limit) {
+    std::vector<Common::Imsi> page, shard;
+    for (; cursor.shard < sessions.shard_count (); ++cursor.shard, cursor.after = {}) {
+        shard.clear ();
+        sessions.collect_shard (cursor.shard, shard);
+        // A session removed and re-created during the scan can be caught in two slots.
+        std::sort (shard.begin (), shard.end ());
+        shard.erase (std::unique (shard.begin (), shard.end ()), shard.end ());
+
+        const auto first = std::upper_bound (shard.begin (), shard.end (), cursor.after);
+        const auto count = std::min<std::size_t> (static_cast<std::size_t> (shard.end () - first), limit - page.size ());
+        page.insert (page.end (), first, first + static_cast<std::ptrdiff_t> (count));
+        if (page.size () < limit)
+            continue;
+        // Full: resume after the last IMSI listed, or at the next shard when this one ended exactly here.
+        if (first + static_cast<std::ptrdiff_t> (count) == shard.end ()) {
+            ++cursor.shard;
+            cursor.after = {};
+        } else {
+            cursor.after = page.back ();
+        }
+        break;
+    }
+
+    std::string out;
+    out.reserve (page.size () * (Common::Imsi::MAX_DIGITS + 3) + 64);
+    out += "{\"sessions\":[";
+    char digits[Common::Imsi::MAX_DIGITS];
+    for (std::size_t i = 0; i < page.size (); ++i) {
+        if (i > 0)
+            out.push_back (',');
+        out.push_back ('"');
+        out.append (digits, page[i].format_to (digits));
+        out.push_back ('"');
+    }
+    out += "],\"next_cursor\":";
+    if (cursor.shard < sessions.shard_count ()) {
+        out.push_back ('"');
+        out += std::to_string (cursor.shard);
+        if (cursor.after.valid ()) {
+            out.push_back (':');
+            out.append (digits, cursor.after.format_to (digits));
+        }
+        out.push_back ('"');
+    } else {
+        out += "null";
+    }
+    out.push_back ('}');
+    return out;
+}
 
-    for (std::size_t i = 0; i < 1; ++i)
-        _workers.emplace_back ([this] { _app.port (_http_port).run (); });
+std::string ControlPlaneServer::offload_status (const Pgw::OffloadScheduler::Progress& progress) {
+    return fmt::format ("{{\"state\":\"{}\",\"total\":{},\"removed\":{},\"remaining\":{},\"rate\":{},"
+    "\"elapsed_sec\":{:.3f},\"eta_sec\":{:.3f}}}",
+    Pgw::OffloadScheduler::to_string (progress.state), progress.total, progress.removed, progress.remaining,
+    progress.rate, progress.elapsed_sec, progress.eta_sec);
 }
 
 void ControlPlaneServer::stop () {
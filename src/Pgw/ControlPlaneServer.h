@@ -2,14 +2,28 @@
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <thread>
 
+#include "BlackListStorer.h"
+#include "OffloadScheduler.h"
 #include "SessionManager.h"
 #include "crow.h"
 
 class ControlPlaneServer {
     public:
     using StopCallback = std::function<void ()>;
+    // Appends Prometheus text exposition lines for GET /metrics.
+    using MetricsSource = std::function<void (std::string&)>;
+    // Graceful offload state for GET /offload.
+    using OffloadSource = std::function<Pgw::OffloadScheduler::Progress ()>;
+
+    static constexpr std::size_t MAX_HTTP_THREADS     = 256;
+    static constexpr std::size_t MAX_BULK_IMSIS       = 100'000;
+    static constexpr std::size_t DEFAULT_SESSION_PAGE = 10'000;
+    static constexpr std::size_t MAX_SESSION_PAGE     = 100'000;
 
     ControlPlaneServer (const Common::ServerSettings& settings,
     SessionManager& session_manager,
@@ -24,10 +38,50 @@ class ControlPlaneServer {
 
     void request_graceful_shutdown () const;
 
+    void set_blacklist (std::shared_ptr<BlackListStorer> blacklist) {
+        _blacklist = std::move (blacklist);
+    }
+
+    void set_metrics_source (MetricsSource source) {
+        _metrics = std::move (source);
+    }
+
+    void set_offload_source (OffloadSource source) {
+        _offload = std::move (source);
+    }
+
+    // POST /check_subscribers body: IMSIs separated by whitespace or commas (a JSON array of strings also parses).
+    // Answers in request order, as a JSON array of true/false with null for malformed IMSIs, or as a bitmap with
+    // bit i (LSB first) set when IMSI i is active. Nothing if the body holds more than MAX_BULK_IMSIS.
+    static std::optional<std::string>
+    check_subscribers (const SessionManager& sessions, std::string_view body, bool bitmap);
+
+    // Where a GET /sessions page starts: the sessions of shard above IMSI after (the whole shard if after is
+    // invalid). Written as "<shard>" or "<shard>:<imsi>".
+    struct SessionCursor {
+        std::size_t shard = 0;
+        Common::Imsi after;
+    };
+
+    static std::optional<SessionCursor> parse_cursor (std::string_view text);
+
+    // One GET /sessions page of at most limit sessions: {"sessions":[...],"next_cursor":"<cursor>"|null}. Each shard
+    // is listed in IMSI order and the cursor names the last IMSI listed, so a session that lives through the dump is
+    // listed once even when pages end mid-shard.
+    static std::string dump_sessions (const SessionManager& sessions, SessionCursor cursor, std::size_t limit);
+
+    // GET /offload body: {"state":"idle|draining|done","total":N,"removed":N,"remaining":N,"rate":R,
+    // "elapsed_sec":S,"eta_sec":S}.
+    static std::string offload_status (const Pgw::OffloadScheduler::Progress& progress);
+
     private:
     uint16_t _http_port;
+    uint16_t _http_threads;
     SessionManager& _session_mgr;
     StopCallback _on_stop;
+    std::shared_ptr<BlackListStorer> _blacklist;
+    MetricsSource _metrics;
+    OffloadSource _offload;
     crow::SimpleApp _app;
     std::vector<std::thread> _workers;
     std::atomic<bool> _running{ false };
@@ -0,0 +1,285 @@
+#include "IoUring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#ifdef PGW_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Pgw {
+#ifdef PGW_HAVE_IO_URING
+namespace {
+template <typename T> T* at (void* base, const uint32_t offset) {
+    return reinterpret_cast<T*> (static_cast<char*> (base) + offset);
+}
+
+unsigned load_acquire (const unsigned* p) {
+    return std::atomic_ref (*const_cast<unsigned*> (p)).load (std::memory_order_acquire);
+}
+
+void store_release (unsigned* p, const unsigned v) {
+    std::atomic_ref (*p).store (v, std::memory_order_release);
+}
+
+static_assert (sizeof (io_uring_recvmsg_out) == IoUring::RECVMSG_HEADER);
+
+void* map_ring (const int fd, const std::size_t size, const off_t offset) {
+    void* p = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (p == MAP_FAILED)
+        throw std::system_error (errno, std::generic_category (), "io_uring mmap");
+    return p;
+}
+} // namespace
+
+IoUring::IoUring (const unsigned entries, const unsigned cq_entries) {
+    // Newer setup flags first: a single issuer that runs completion work only when it enters the kernel saves the
+    // task-work interrupts. Older kernels reject them with EINVAL.
+    for (const unsigned flags :
+    { IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, IORING_SETUP_COOP_TASKRUN, 0u }) {
+        io_uring_params params{};
+        params.flags      = flags | IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+        _fd               = static_cast<int> (syscall (__NR_io_uring_setup, entries, &params));
+        if (_fd < 0 && errno == EINVAL && flags != 0)
+            continue;
+        if (_fd < 0)
+            throw std::system_error (errno, std::generic_category (), "io_uring_setup");
+
+        try {
+            _sq_size          = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+            _cq_size          = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+            const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single)
+                _sq_size = _cq_size = std::max (_sq_size, _cq_size);
+            _sq_map    = map_ring (_fd, _sq_size, IORING_OFF_SQ_RING);
+            _cq_map    = single ? _sq_map : map_ring (_fd, _cq_size, IORING_OFF_CQ_RING);
+            _sqes_size = params.sq_entries * sizeof (io_uring_sqe);
+            _sqes      = static_cast<io_uring_sqe*> (map_ring (_fd, _sqes_size, IORING_OFF_SQES));
+        } catch (...) {
+            unmap ();
+            throw;
+        }
+
+        _sq_head    = at<unsigned> (_sq_map, params.sq_off.head);
+        _sq_tail    = at<unsigned> (_sq_map, params.sq_off.tail);
+        _sq_mask    = *at<unsigned> (_sq_map, params.sq_off.ring_mask);
+        _sq_entries = params.sq_entries;
+        _cq_head    = at<unsigned> (_cq_map, params.cq_off.head);
+        _cq_tail    = at<unsigned> (_cq_map, params.cq_off.tail);
+        _cq_mask    = *at<unsigned> (_cq_map, params.cq_off.ring_mask);
+        _cqes       = at<io_uring_cqe> (_cq_map, params.cq_off.cqes);
+        // SQE i always sits in slot i, so the indirection array is filled once.
+        auto* array = at<unsigned> (_sq_map, params.sq_off.array);
+        for (unsigned i = 0; i < _sq_entries; ++i)
+            array[i] = i;
+        _sq_local_tail = _sq_submitted = *_sq_tail;
+        return;
+    }
+}
+
+IoUring::~IoUring () {
+    unmap ();
+}
+
+void IoUring::unmap () {
+    if (_buf_ring)
+        munmap (_buf_ring, _buf_ring_size);
+    if (_buffers)
+        munmap (_buffers, _buffers_size);
+    if (_sqes)
+        munmap (_sqes, _sqes_size);
+    if (_cq_map && _cq_map != _sq_map)
+        munmap (_cq_map, _cq_size);
+    if (_sq_map)
+        munmap (_sq_map, _sq_size);
+    if (_fd != -1)
+        close (_fd);
+}
+
+void IoUring::provide_buffers (const unsigned count, const std::size_t size) {
+    const auto fail = [] (const char* what) { throw std::system_error (errno, std::generic_category (), what); };
+    _buf_ring_size  = count * sizeof (io_uring_buf);
+    _buf_ring       = mmap (nullptr, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (_buf_ring == MAP_FAILED) {
+        _buf_ring = nullptr;
+        fail ("mmap buffer ring");
+    }
+    _buffers_size = count * size;
+    void* buffers = mmap (nullptr, _buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+        fail ("mmap buffers");
+    _buffers     = static_cast<uint8_t*> (buffers);
+    _buffer_size = size;
+    _buf_count   = count;
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr    = reinterpret_cast<uint64_t> (_buf_ring);
+    reg.ring_entries = count;
+    reg.bgid         = 0;
+    if (syscall (__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+        fail ("io_uring_register(PBUF_RING)");
+    for (unsigned bid = 0; bid < count; ++bid)
+        recycle_buffer ({ 0, 0, IORING_CQE_F_BUFFER | (bid << IORING_CQE_BUFFER_SHIFT) });
+    publish_buffers ();
+}
+
+io_uring_sqe* IoUring::next_sqe () {
+    if (_sq_local_tail - load_acquire (_sq_head) >= _sq_entries)
+        return nullptr;
+    auto* sqe = &_sqes[_sq_local_tail++ & _sq_mask];
+    std::memset (sqe, 0, sizeof *sqe);
+    return sqe;
+}
+
+bool IoUring::recvmsg_multishot (const int fd, msghdr* hdr, const uint64_t user_data) {
+    auto* sqe = next_sqe ();
+    if (!sqe)
+        return false;
+    sqe->opcode    = IORING_OP_RECVMSG;
+    sqe->fd        = fd;
+    sqe->addr      = reinterpret_cast<uint64_t> (hdr);
+    sqe->len       = 1;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IoUring::sendmsg (const int fd, const msghdr* hdr, const int flags, const uint64_t user_data) {
+    auto* sqe = next_sqe ();
+    if (!sqe)
+        return false;
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = fd;
+    sqe->addr      = reinterpret_cast<uint64_t> (hdr);
+    sqe->len       = 1;
+    sqe->msg_flags = static_cast<uint32_t> (flags);
+    sqe->user_data = user_data;
+    return true;
+}
+
+int IoUring::submit_and_wait (const unsigned wait_nr, const std::chrono::microseconds timeout) {
+    store_release (_sq_tail, _sq_local_tail);
+    const unsigned to_submit = _sq_local_tail - _sq_submitted;
+
+    __kernel_timespec ts{};
+    ts.tv_sec  = timeout.count () / 1'000'000;
+    ts.tv_nsec = (timeout.count () % 1'000'000) * 1000;
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz       = _NSIG / 8;
+    arg.ts               = reinterpret_cast<uint64_t> (&ts);
+    const unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    const long rc        = syscall (__NR_io_uring_enter, _fd, to_submit, wait_nr, flags, &arg, sizeof arg);
+    if (rc < 0)
+        return -errno;
+    _sq_submitted += static_cast<unsigned> (rc);
+    return static_cast<int> (rc);
+}
+
+bool IoUring::peek (Completion& out) const {
+    const unsigned head = *_cq_head;
+    if (head == load_acquire (_cq_tail))
+        return false;
+    const auto& cqe = static_cast<const io_uring_cqe*> (_cqes)[head & _cq_mask];
+    out             = { cqe.user_data, cqe.res, cqe.flags };
+    return true;
+}
+
+void IoUring::advance () {
+    store_release (_cq_head, *_cq_head + 1);
+}
+
+bool IoUring::parse_datagram (const Completion& c, const msghdr& hdr, Datagram& out) const {
+    if (!(c.flags & IORING_CQE_F_BUFFER) || c.res < 0)
+        return false;
+    const auto header = sizeof (io_uring_recvmsg_out) + hdr.msg_namelen + hdr.msg_controllen;
+    if (static_cast<std::size_t> (c.res) < header)
+        return false;
+    const auto bid = c.flags >> IORING_CQE_BUFFER_SHIFT;
+    if (bid >= _buf_count)
+        return false;
+    const uint8_t* buf = _buffers + bid * _buffer_size;
+    const auto* msg    = reinterpret_cast<const io_uring_recvmsg_out*> (buf);
+    out.name           = reinterpret_cast<const sockaddr*> (buf + sizeof (io_uring_recvmsg_out));
+    out.name_len       = std::min<socklen_t> (msg->namelen, hdr.msg_namelen);
+    out.payload        = { buf + header, static_cast<std::size_t> (c.res) - header };
+    out.truncated      = msg->flags & MSG_TRUNC;
+    return true;
+}
+
+void IoUring::recycle_buffer (const Completion& c) {
+    if (!(c.flags & IORING_CQE_F_BUFFER))
+        return;
+    const auto bid = static_cast<uint16_t> (c.flags >> IORING_CQE_BUFFER_SHIFT);
+    auto& buf      = static_cast<io_uring_buf*> (_buf_ring)[_buf_tail++ & (_buf_count - 1)];
+    buf.addr       = reinterpret_cast<uint64_t> (_buffers + bid * _buffer_size);
+    buf.len        = static_cast<uint32_t> (_buffer_size);
+    buf.bid        = bid;
+}
+
+void IoUring::publish_buffers () {
+    // The tail overlays resv of the first entry. Not through io_uring_buf_ring::bufs: its flexible array member sits
+    // 8 bytes off in C++.
+    std::atomic_ref (static_cast<io_uring_buf*> (_buf_ring)->resv).store (_buf_tail, std::memory_order_release);
+}
+
+bool IoUring::more (const Completion& c) {
+    return c.flags & IORING_CQE_F_MORE;
+}
+#else
+IoUring::IoUring (unsigned, unsigned) {
+    throw std::system_error (ENOSYS, std::generic_category (), "built without io_uring support");
+}
+
+IoUring::~IoUring () = default;
+
+void IoUring::unmap () {
+}
+
+void IoUring::provide_buffers (unsigned, std::size_t) {
+}
+
+bool IoUring::recvmsg_multishot (int, msghdr*, uint64_t) {
+    return false;
+}
+
+bool IoUring::sendmsg (int, const msghdr*, int, uint64_t) {
+    return false;
+}
+
+int IoUring::submit_and_wait (unsigned, std::chrono::microseconds) {
+    return -ENOSYS;
+}
+
+bool IoUring::peek (Completion&) const {
+    return false;
+}
+
+void IoUring::advance () {
+}
+
+bool IoUring::parse_datagram (const Completion&, const msghdr&, Datagram&) const {
+    return false;
+}
+
+void IoUring::recycle_buffer (const Completion&) {
+}
+
+void IoUring::publish_buffers () {
+}
+
+bool IoUring::more (const Completion&) {
+    return false;
+}
+#endif
+} // namespace Pgw
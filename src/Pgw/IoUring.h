@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <sys/socket.h>
+
+struct io_uring_sqe;
+
+namespace Pgw {
+// Minimal io_uring over the raw syscalls (no liburing), owned and driven by a single thread: a submission and a
+// completion ring, plus an optional ring of provided receive buffers. Built without PGW_HAVE_IO_URING, or on a
+// kernel without io_uring, the constructor throws std::system_error and callers stay on epoll.
+class IoUring {
+    public:
+    struct Completion {
+        uint64_t user_data;
+        int32_t res;
+        uint32_t flags;
+    };
+
+    // One datagram delivered by a multishot recvmsg into a provided buffer.
+    struct Datagram {
+        const sockaddr* name;
+        socklen_t name_len;
+        std::span<const uint8_t> payload;
+        bool truncated;
+    };
+
+    // Bytes of the io_uring_recvmsg_out header in front of every provided receive buffer.
+    static constexpr std::size_t RECVMSG_HEADER = 16;
+
+    IoUring (unsigned entries, unsigned cq_entries);
+
+    ~IoUring ();
+
+    IoUring (const IoUring&) = delete;
+
+    IoUring& operator= (const IoUring&) = delete;
+
+    // Registers count buffers of size bytes each (count a power of two) as buffer group 0, all handed to the kernel.
+    void provide_buffers (unsigned count, std::size_t size);
+
+    // Queue one request; false when the submission ring is full.
+    bool recvmsg_multishot (int fd, msghdr* hdr, uint64_t user_data);
+
+    bool sendmsg (int fd, const msghdr* hdr, int flags, uint64_t user_data);
+
+    // Submits everything queued and waits up to timeout for wait_nr completions; one io_uring_enter. Returns the
+    // syscall result (-errno on failure, -ETIME on timeout).
+    int submit_and_wait (unsigned wait_nr, std::chrono::microseconds timeout);
+
+    // Hands every available completion to on_completion and releases it.
+    template <typename OnCompletion> unsigned drain (OnCompletion&& on_completion) {
+        unsigned n = 0;
+        for (Completion c; peek (c); ++n) {
+            advance ();
+            on_completion (c);
+        }
+        return n;
+    }
+
+    // Buffer of a recvmsg completion with IORING_CQE_F_BUFFER set; nothing when the buffer is shorter than hdr.
+    bool parse_datagram (const Completion& c, const msghdr& hdr, Datagram& out) const;
+
+    // Gives a buffer back to the kernel; recycled buffers become visible at the next publish_buffers.
+    void recycle_buffer (const Completion& c);
+
+    void publish_buffers ();
+
+    static bool more (const Completion& c);
+
+    private:
+    bool peek (Completion& out) const;
+
+    void advance ();
+
+    io_uring_sqe* next_sqe ();
+
+    void unmap ();
+
+    int _fd = -1;
+    // Mappings, unmapped on destruction; _cq_map is only separate on kernels without IORING_FEAT_SINGLE_MMAP.
+    void* _sq_map          = nullptr;
+    std::size_t _sq_size   = 0;
+    void* _cq_map          = nullptr;
+    std::size_t _cq_size   = 0;
+    io_uring_sqe* _sqes    = nullptr;
+    std::size_t _sqes_size = 0;
+
+    unsigned* _sq_head      = nullptr;
+    unsigned* _sq_tail      = nullptr;
+    unsigned _sq_mask       = 0;
+    unsigned _sq_entries    = 0;
+    unsigned _sq_local_tail = 0;
+    unsigned _sq_submitted  = 0;
+    unsigned* _cq_head      = nullptr;
+    unsigned* _cq_tail      = nullptr;
+    unsigned _cq_mask       = 0;
+    const void* _cqes       = nullptr;
+
+    void* _buf_ring            = nullptr;
+    std::size_t _buf_ring_size = 0;
+    uint8_t* _buffers          = nullptr;
+    std::size_t _buffers_size  = 0;
+    std::size_t _buffer_size   = 0;
+    unsigned _buf_count        = 0;
+    uint16_t _buf_tail         = 0;
+};
+} // namespace Pgw
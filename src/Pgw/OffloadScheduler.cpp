@@ -0,0 +1,114 @@
+#include "OffloadScheduler.h"
+
+#include <algorithm>
+
+#include "../Common/Clock.h"
+
+namespace Pgw {
+using Common::steady_now_ns;
+
+OffloadScheduler::OffloadScheduler (SessionManager& sessions,
+const std::size_t rate,
+const std::chrono::microseconds tick,
+const std::shared_ptr<spdlog::logger>& logger)
+: _sessions (sessions), _rate (rate), _tick (std::max (tick, std::chrono::microseconds (1))), _logger (logger) {
+}
+
+OffloadScheduler::~OffloadScheduler () {
+    {
+        std::lock_guard lock (_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all ();
+    if (_thread.joinable () && _thread.get_id () != std::this_thread::get_id ())
+        _thread.join ();
+}
+
+void OffloadScheduler::start (std::function<void ()> on_done) {
+    if (State expected = State::idle; !_state.compare_exchange_strong (expected, State::draining))
+        return;
+    _total.store (_sessions.session_count (), std::memory_order_relaxed);
+    _started_ns.store (steady_now_ns (), std::memory_order_relaxed);
+    _logger->info ("Starting graceful offload of {} sessions, rate={} sess/s", _total.load (), _rate);
+    _thread = std::thread (&OffloadScheduler::run, this, std::move (on_done));
+}
+
+void OffloadScheduler::wait () {
+    if (_thread.joinable () && _thread.get_id () != std::this_thread::get_id ())
+        _thread.join ();
+}
+
+void OffloadScheduler::run (std::function<void ()> on_done) {
+    using namespace std::chrono;
+    // One tick's worth of tokens at most, so a late wake-up does not turn into a burst.
+    const double burst = std::max (1.0, static_cast<double> (_rate) * duration<double> (_tick).count ());
+    double tokens      = 1;
+    auto last          = steady_clock::now ();
+    std::unique_lock lock (_mutex);
+    while (!_stopping && _rate > 0) {
+        lock.unlock ();
+        const auto now    = steady_clock::now ();
+        const auto refill = static_cast<double> (_rate) * duration<double> (now - last).count ();
+        tokens            = std::min (burst, tokens + refill);
+        last              = now;
+        const auto max    = static_cast<std::size_t> (tokens);
+        if (max > 0) {
+            const auto removed = remove_batch (max);
+            _removed.fetch_add (removed, std::memory_order_relaxed);
+            tokens -= static_cast<double> (removed);
+            if (removed < max && _sessions.session_count () == 0)
+                break;
+        }
+        lock.lock ();
+        // Sleep until the next whole token, but never shorter than a tick.
+        auto pause = duration_cast<nanoseconds> (_tick);
+        if (tokens < 1)
+            pause = std::max (pause, duration_cast<nanoseconds> (duration<double> ((1 - tokens) / _rate)));
+        _cv.wait_for (lock, pause, [this] { return _stopping; });
+    }
+    if (lock.owns_lock ())
+        lock.unlock ();
+
+    _finished_ns.store (steady_now_ns (), std::memory_order_relaxed);
+    _state.store (State::done, std::memory_order_release);
+    _logger->info ("Graceful offload finished: {} sessions removed, {} left", _removed.load (),
+    _sessions.session_count ());
+    if (on_done)
+        on_done ();
+}
+
+std::size_t OffloadScheduler::remove_batch (const std::size_t max) {
+    // Walks the shards round-robin from the cursor; a shard that runs short hands the rest to the next one. The
+    // cursor moves on after every batch, so consecutive batches spread over the shards.
+    std::size_t removed = 0;
+    for (std::size_t visited = 0; visited < _sessions.shard_count () && removed < max; ++visited) {
+        removed += _sessions.offload_batch (_cursor, std::min (max - removed, MAX_BATCH));
+        _cursor = (_cursor + 1) % _sessions.shard_count ();
+    }
+    return removed;
+}
+
+OffloadScheduler::Progress OffloadScheduler::progress () const {
+    Progress p;
+    p.state = _state.load (std::memory_order_acquire);
+    if (p.state == State::idle)
+        return p;
+    p.total           = _total.load (std::memory_order_relaxed);
+    p.removed         = _removed.load (std::memory_order_relaxed);
+    p.remaining       = _sessions.session_count ();
+    p.rate            = static_cast<double> (_rate);
+    const auto end_ns = p.state == State::done ? _finished_ns.load (std::memory_order_relaxed) : steady_now_ns ();
+    p.elapsed_sec     = static_cast<double> (end_ns - _started_ns.load (std::memory_order_relaxed)) / 1e9;
+    p.eta_sec         = _rate > 0 && p.state == State::draining ? static_cast<double> (p.remaining) / p.rate : 0;
+    return p;
+}
+
+std::string_view OffloadScheduler::to_string (const State state) {
+    switch (state) {
+    case State::idle: return "idle";
+    case State::draining: return "draining";
+    case State::done: return "done";
+    }
+    return "unknown";
+}
+} // namespace Pgw
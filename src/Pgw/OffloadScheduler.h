@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#include "SessionManager.h"
+#include "spdlog/logger.h"
+
+namespace Pgw {
+// Graceful offload at a steady rate. A token bucket refills at rate sessions/s and is checked every tick (well
+// below a millisecond), so evictions are spread evenly instead of arriving once a second in a burst. Each wake-up
+// removes the available tokens' worth of sessions in batches of at most MAX_BATCH per shard lock
+// (SessionManager::offload_batch), moving to the next shard every batch so no shard is held up by the drain for long.
+class OffloadScheduler {
+    public:
+    static constexpr std::size_t MAX_BATCH = 256;
+
+    enum class State : uint8_t { idle, draining, done };
+
+    struct Progress {
+        State state = State::idle;
+        std::size_t total     = 0; // sessions when the drain started
+        std::size_t removed   = 0;
+        std::size_t remaining = 0;
+        double rate           = 0; // configured sessions/s
+        double elapsed_sec    = 0;
+        double eta_sec        = 0;
+    };
+
+    // rate 0 offloads nothing: a started drain finishes at once and leaves the sessions in place.
+    OffloadScheduler (SessionManager& sessions,
+    std::size_t rate,
+    std::chrono::microseconds tick,
+    const std::shared_ptr<spdlog::logger>& logger);
+
+    ~OffloadScheduler ();
+
+    OffloadScheduler (const OffloadScheduler&) = delete;
+
+    OffloadScheduler& operator= (const OffloadScheduler&) = delete;
+
+    // Starts the drain once; on_done runs on the drain thread when no session is left.
+    void start (std::function<void ()> on_done);
+
+    // Blocks until a started drain has finished.
+    void wait ();
+
+    bool draining () const {
+        return _state.load (std::memory_order_relaxed) != State::idle;
+    }
+
+    Progress progress () const;
+
+    static std::string_view to_string (State state);
+
+    private:
+    void run (std::function<void ()> on_done);
+
+    std::size_t remove_batch (std::size_t max);
+
+    SessionManager& _sessions;
+    const std::size_t _rate;
+    const std::chrono::microseconds _tick;
+    std::shared_ptr<spdlog::logger> _logger;
+
+    std::atomic<State> _state{ State::idle };
+    std::atomic<std::size_t> _total{ 0 };
+    std::atomic<std::size_t> _removed{ 0 };
+    std::atomic<int64_t> _started_ns{ 0 };
+    std::atomic<int64_t> _finished_ns{ 0 };
+    std::size_t _cursor = 0; // next shard to drain; drain thread only
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stopping = false;
+    std::thread _thread;
+};
+} // namespace Pgw
@@ -1,77 +1,397 @@
 #include "SessionManager.h"
 
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <utility>
 
-SessionManager::SessionManager (const size_t timeout_sec, CdrWriter& writer, const std::shared_ptr<spdlog::logger>& logger)
-: _timeout_sec (timeout_sec), _cdr_writer (writer), _logger (logger) {
+
+SessionManager::SessionManager (const size_t timeout_sec,
+CdrWriter& writer,
+const std::shared_ptr<spdlog::logger>& logger,
+const std::size_t shard_count)
+: _timeout_sec (timeout_sec),
+  _journal_refresh_interval (std::chrono::seconds (timeout_sec) / JOURNAL_REFRESH_DIVISOR), _shards (std::bit_ceil (std::clamp<std::size_t> (shard_count, 1, MAX_SHARDS))),
+  _shard_bits (std::countr_zero (_shards.size ())), _cdr_writer (writer), _logger (logger) {
 }
 
-bool SessionManager::create_session (const std::string& imsi) {
-    std::lock_guard lock (_mutex);
-    const auto now = std::chrono::steady_clock::now ();
+SessionManager::Shard& SessionManager::shard_for (const Common::Imsi& imsi) {
+    return const_cast<Shard&> (std::as_const (*this).shard_for (imsi));
+}
 
-    auto [it, inserted] = _sessions.try_emplace (imsi, SessionInfo{ now });
-    if (!inserted) {
-        it->second.start_time = now;
-        return false;
+const SessionManager::Shard& SessionManager::shard_for (const Common::Imsi& imsi) const {
+    if (_shard_bits == 0)
+        return _shards.front ();
+    // Fibonacci hashing: take the top bits so shard choice is independent of the in-shard bucket index.
+    const std::size_t h = std::hash<Common::Imsi>{}(imsi) * 0x9E3779B97F4A7C15ULL;
+    return _shards[h >> (64 - _shard_bits)];
+}
+
+uint16_t SessionManager::shard_index (const Shard& shard) const {
+    return static_cast<uint16_t> (&shard - _shards.data ());
+}
+
+uint16_t SessionManager::shard_of (const Common::Imsi& imsi) const {
+    return shard_index (shard_for (imsi));
+}
+
+void SessionManager::journal (Shard& shard,
+const Common::Imsi& imsi,
+const std::chrono::steady_clock::time_point at,
+const bool removed) {
+    if (_journaling.load (std::memory_order_relaxed))
+        shard.journal.push_back ({ imsi, at, removed });
+}
+
+void SessionManager::refresh (Shard& shard, SessionInfo& info, const std::chrono::steady_clock::time_point now) {
+    info.start_time = now;
+    unlink (shard, info);
+    link_newest (shard, info);
+    if (now - info.journaled >= _journal_refresh_interval && _journaling.load (std::memory_order_relaxed)) {
+        journal (shard, info.imsi, now, false);
+        info.journaled = now;
     }
+}
+
+void SessionManager::link_newest (Shard& shard, SessionInfo& info) {
+    info.prev = shard.newest;
+    info.next = nullptr;
+    if (shard.newest)
+        shard.newest->next = &info;
+    else
+        shard.oldest = &info;
+    shard.newest = &info;
+}
+
+void SessionManager::unlink (Shard& shard, SessionInfo& info) {
+    (info.prev ? info.prev->next : shard.oldest) = info.next;
+    (info.next ? info.next->prev : shard.newest) = info.prev;
+    info.prev = info.next = nullptr;
+}
 
-    _cdr_writer.write (imsi, "created");
+void SessionManager::presence_insert (Shard& shard, const Common::Imsi& imsi) {
+    presence_reclaim (shard);
+    auto* table = shard.presence_owner.get ();
+    if (!table || (table->used + 1) * 2 > table->slots.size ()) {
+        // sessions already holds imsi, so the rebuilt table does too.
+        presence_rebuild (shard);
+        return;
+    }
+    std::size_t i                = std::hash<Common::Imsi>{}(imsi) & table->mask;
+    std::atomic<uint64_t>* reuse = nullptr;
+    for (;; i = (i + 1) & table->mask) {
+        const uint64_t v = table->slots[i].load (std::memory_order_relaxed);
+        if (v == imsi.raw ())
+            return;
+        if (v == PresenceTable::TOMBSTONE && !reuse)
+            reuse = &table->slots[i];
+        if (v == PresenceTable::EMPTY)
+            break;
+    }
+    if (!reuse) {
+        reuse = &table->slots[i];
+        ++table->used;
+    }
+    reuse->store (imsi.raw (), std::memory_order_release);
+}
+
+void SessionManager::presence_erase (Shard& shard, const Common::Imsi& imsi) {
+    presence_reclaim (shard);
+    auto* table = shard.presence_owner.get ();
+    if (!table)
+        return;
+    for (std::size_t i = std::hash<Common::Imsi>{}(imsi) & table->mask;; i = (i + 1) & table->mask) {
+        const uint64_t v = table->slots[i].load (std::memory_order_relaxed);
+        if (v == PresenceTable::EMPTY)
+            return;
+        if (v == imsi.raw ()) {
+            table->slots[i].store (PresenceTable::TOMBSTONE, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+void SessionManager::presence_rebuild (Shard& shard) {
+    const std::size_t capacity = std::bit_ceil (std::max<std::size_t> (shard.sessions.size () * 4, 16));
+    auto table                 = std::make_unique<PresenceTable> (capacity);
+    for (const auto& [imsi, info] : shard.sessions) {
+        std::size_t i = std::hash<Common::Imsi>{}(imsi) & table->mask;
+        while (table->slots[i].load (std::memory_order_relaxed) != PresenceTable::EMPTY)
+            i = (i + 1) & table->mask;
+        table->slots[i].store (imsi.raw (), std::memory_order_relaxed);
+    }
+    table->used = shard.sessions.size ();
+
+    // seq_cst pairs with PresenceReader: a lookup that registers under a later epoch sees the new table.
+    shard.presence.store (table.get ());
+    if (shard.presence_owner)
+        shard.presence_retired.push_back ({ std::move (shard.presence_owner), shard.epoch.load () });
+    shard.presence_owner = std::move (table);
+    presence_reclaim (shard);
+}
+
+void SessionManager::presence_reclaim (Shard& shard) {
+    if (shard.presence_retired.empty ())
+        return;
+    // The epoch only moved on once the lookups of the one before it had left, so lookups still holding a table
+    // retired before this epoch are all counted under the previous one.
+    const uint64_t epoch = shard.epoch.load ();
+    if (shard.readers[(epoch - 1) & 1].load () != 0)
+        return;
+    std::erase_if (shard.presence_retired, [&] (const RetiredPresence& r) { return r.epoch < epoch; });
+    if (!shard.presence_retired.empty ())
+        shard.epoch.store (epoch + 1);
+}
+
+SessionManager::PresenceReader::PresenceReader (const SessionManager& sessions, const std::size_t shard)
+: PresenceReader (sessions._shards.at (shard)) {
+}
+
+SessionManager::PresenceReader::PresenceReader (const Shard& shard) : _shard (shard) {
+    // A writer that moves the epoch on between the two loads may already have found the old counter drained, so
+    // register again under the new one.
+    for (;;) {
+        const uint64_t epoch = shard.epoch.load ();
+        _parity              = epoch & 1;
+        shard.readers[_parity].fetch_add (1);
+        if (shard.epoch.load () == epoch)
+            return;
+        shard.readers[_parity].fetch_sub (1, std::memory_order_release);
+    }
+}
+
+SessionManager::PresenceReader::~PresenceReader () {
+    _shard.readers[_parity].fetch_sub (1, std::memory_order_release);
+}
+
+std::size_t SessionManager::retired_presence_tables (const std::size_t shard_index) const {
+    const auto& shard = _shards.at (shard_index);
+    std::lock_guard lock (shard.mutex);
+    return shard.presence_retired.size ();
+}
+
+bool SessionManager::create_session (const Common::Imsi& imsi) {
+    auto& shard = shard_for (imsi);
+    {
+        std::lock_guard lock (shard.mutex);
+        // Taken under the lock so the refresh chain stays ordered by start_time.
+        const auto now      = std::chrono::steady_clock::now ();
+        auto [it, inserted] = shard.sessions.try_emplace (imsi, SessionInfo{ now, now, imsi });
+        if (!inserted) {
+            refresh (shard, it->second, now);
+            return false;
+        }
+        journal (shard, imsi, now, false);
+        link_newest (shard, it->second);
+        presence_insert (shard, imsi);
+        shard.size.store (shard.sessions.size (), std::memory_order_relaxed);
+    }
+
+    _cdr_writer.write (imsi, Common::CdrAction::created, shard_index (shard));
     _logger->info ("Session created: {}", imsi);
     return true;
 }
 
+bool SessionManager::refresh_session (const Common::Imsi& imsi) {
+    auto& shard = shard_for (imsi);
+    std::lock_guard lock (shard.mutex);
+    const auto it = shard.sessions.find (imsi);
+    if (it == shard.sessions.end ())
+        return false;
+    refresh (shard, it->second, std::chrono::steady_clock::now ());
+    return true;
+}
+
+
+bool SessionManager::has_session (const Common::Imsi& imsi) const {
+    const auto& shard = shard_for (imsi);
+    const PresenceReader reader (shard);
+    const auto* table = shard.presence.load ();
+    bool found        = false;
+    if (table) {
+        for (std::size_t i = std::hash<Common::Imsi>{}(imsi) & table->mask;; i = (i + 1) & table->mask) {
+            const uint64_t v = table->slots[i].load (std::memory_order_acquire);
+            if (v == imsi.raw ())
+                found = true;
+            if (found || v == PresenceTable::EMPTY)
+                break;
+        }
+    }
+    return found;
+}
+
+void SessionManager::collect_shard (const std::size_t shard_index, std::vector<Common::Imsi>& out) const {
+    const auto& shard = _shards.at (shard_index);
+    const PresenceReader reader (shard);
+    if (const auto* table = shard.presence.load ()) {
+        for (const auto& slot : table->slots) {
+            const uint64_t v = slot.load (std::memory_order_acquire);
+            if (v != PresenceTable::EMPTY && v != PresenceTable::TOMBSTONE)
+                out.push_back (Common::Imsi::from_raw (v));
+        }
+    }
+}
+
+void SessionManager::take_journal (const std::size_t shard_index, std::vector<SessionEvent>& out) {
+    out.clear ();
+    auto& shard = _shards.at (shard_index);
+    std::lock_guard lock (shard.mutex);
+    out.swap (shard.journal);
+}
+
+void SessionManager::capture_shard (const std::size_t shard_index,
+std::vector<SessionEvent>& sessions,
+std::vector<SessionEvent>& journal) {
+    journal.clear ();
+    auto& shard = _shards.at (shard_index);
+    std::lock_guard lock (shard.mutex);
+    for (const auto* info = shard.oldest; info; info = info->next)
+        sessions.push_back ({ info->imsi, info->start_time, false });
+    journal.swap (shard.journal);
+}
+
+std::size_t SessionManager::restore (const std::vector<SessionEvent>& sessions) {
+    std::vector<std::vector<const SessionEvent*> > by_shard (_shards.size ());
+    for (const auto& s : sessions)
+        by_shard[shard_index (shard_for (s.imsi))].push_back (&s);
 
-bool SessionManager::has_session (const std::string& imsi) const {
-    std::lock_guard lock (_mutex);
-    return _sessions.contains (imsi);
+    std::atomic<std::size_t> next{ 0 };
+    std::atomic<std::size_t> added{ 0 };
+    const auto fill = [&] {
+        for (std::size_t i; (i = next.fetch_add (1)) < _shards.size ();) {
+            auto& events = by_shard[i];
+            if (events.empty ())
+                continue;
+            // The refresh chain must stay ordered by start_time.
+            std::stable_sort (
+            events.begin (), events.end (), [] (const auto* a, const auto* b) { return a->at < b->at; });
+            auto& shard = _shards[i];
+            std::lock_guard lock (shard.mutex);
+            shard.sessions.reserve (shard.sessions.size () + events.size ());
+            std::size_t n = 0;
+            for (const auto* e : events) {
+                auto [it, inserted] = shard.sessions.try_emplace (e->imsi, SessionInfo{ e->at, e->at, e->imsi });
+                if (inserted) {
+                    link_newest (shard, it->second);
+                    ++n;
+                }
+            }
+            presence_rebuild (shard);
+            shard.size.store (shard.sessions.size (), std::memory_order_relaxed);
+            added.fetch_add (n, std::memory_order_relaxed);
+        }
+    };
+    const std::size_t workers = std::clamp<std::size_t> (std::thread::hardware_concurrency (), 1, 8);
+    std::vector<std::thread> threads;
+    for (std::size_t w = 1; w < workers; ++w)
+        threads.emplace_back (fill);
+    fill ();
+    for (auto& t : threads)
+        t.join ();
+    return added.load ();
 }
 
 void SessionManager::remove_timeout () {
-    const auto now = std::chrono::steady_clock::now ();
-    std::vector<std::string> to_remove;
-    {
-        std::lock_guard lock (_mutex);
-        for (auto& [imsi, info] : _sessions) {
-            if (const auto age = std::chrono::duration_cast<std::chrono::seconds> (now - info.start_time).count ();
-            age >= static_cast<long> (_timeout_sec))
-                to_remove.push_back (imsi);
+    const auto now      = std::chrono::steady_clock::now ();
+    const auto deadline = now - std::chrono::seconds (_timeout_sec);
+    std::vector<std::pair<Common::Imsi, uint16_t> > to_remove;
+    for (auto& shard : _shards) {
+        if (shard.size.load (std::memory_order_relaxed) == 0)
+            continue;
+
+        std::lock_guard lock (shard.mutex);
+        while (shard.oldest && shard.oldest->start_time <= deadline) {
+            const auto imsi = shard.oldest->imsi;
+            unlink (shard, *shard.oldest);
+            shard.sessions.erase (imsi);
+            presence_erase (shard, imsi);
+            journal (shard, imsi, now, true);
+            to_remove.emplace_back (imsi, shard_index (shard));
         }
-        for (auto& imsi : to_remove)
-            _sessions.erase (imsi);
+        shard.size.store (shard.sessions.size (), std::memory_order_relaxed);
     }
-    for (auto& imsi : to_remove) {
-        _cdr_writer.write (imsi, "timeout");
+    _timeouts.fetch_add (to_remove.size (), std::memory_order_relaxed);
+    for (const auto& [imsi, shard] : to_remove) {
+        _cdr_writer.write (imsi, Common::CdrAction::timeout, shard);
         _logger->info ("Session timed‑out and removed: {}", imsi);
     }
 }
 
-bool SessionManager::remove_session (const std::string& imsi, std::string_view reason) {
-    std::lock_guard lock (_mutex);
-    const auto it = _sessions.find (imsi);
-    if (it == _sessions.end ())
-        return false;
-    _sessions.erase (it);
-    _cdr_writer.write (imsi, std::string (reason));
-    _logger->info ("Session removed: {} (reason={})", imsi, reason);
+bool SessionManager::remove_session (const Common::Imsi& imsi, const Common::CdrAction reason) {
+    auto& shard = shard_for (imsi);
+    {
+        std::lock_guard lock (shard.mutex);
+        const auto it = shard.sessions.find (imsi);
+        if (it == shard.sessions.end ())
+            return false;
+        unlink (shard, it->second);
+        shard.sessions.erase (it);
+        presence_erase (shard, imsi);
+        journal (shard, imsi, std::chrono::steady_clock::now (), true);
+        shard.size.store (shard.sessions.size (), std::memory_order_relaxed);
+    }
+    _cdr_writer.write (imsi, reason, shard_index (shard));
+    _logger->info ("Session removed: {} (reason={})", imsi, to_string (reason));
     return true;
 }
 
 
 size_t SessionManager::session_count () const {
-    std::lock_guard lock (_mutex);
-    return _sessions.size ();
+    std::size_t total = 0;
+    for (const auto& shard : _shards)
+        total += shard.size.load (std::memory_order_relaxed);
+    return total;
 }
 
-bool SessionManager::pop_one (std::string& imsi_out) {
-    std::lock_guard lock (_mutex);
-    if (_sessions.empty ())
-        return false;
+bool SessionManager::pop_one (Common::Imsi& imsi_out) {
+    const std::size_t start = _pop_cursor.fetch_add (1, std::memory_order_relaxed);
+    bool found              = false;
+    for (std::size_t i = 0; i < _shards.size () && !found; ++i) {
+        auto& shard = _shards[(start + i) & (_shards.size () - 1)];
+        if (shard.size.load (std::memory_order_relaxed) == 0)
+            continue;
 
-    const auto it = _sessions.begin ();
-    imsi_out      = it->first;
-    _sessions.erase (it);
+        std::lock_guard lock (shard.mutex);
+        if (!shard.oldest)
+            continue;
+        imsi_out = shard.oldest->imsi;
+        unlink (shard, *shard.oldest);
+        shard.sessions.erase (imsi_out);
+        presence_erase (shard, imsi_out);
+        journal (shard, imsi_out, std::chrono::steady_clock::now (), true);
+        shard.size.store (shard.sessions.size (), std::memory_order_relaxed);
+        found = true;
+    }
+    if (!found)
+        return false;
 
-    _cdr_writer.write (imsi_out, "offload");
+    _cdr_writer.write (imsi_out, Common::CdrAction::offload, shard_of (imsi_out));
     _logger->info ("Session removed (offload): {}", imsi_out);
     return true;
 }
+
+std::size_t SessionManager::offload_batch (const std::size_t shard_index, const std::size_t max) {
+    auto& shard = _shards.at (shard_index);
+    if (max == 0 || shard.size.load (std::memory_order_relaxed) == 0)
+        return 0;
+
+    std::vector<Common::Imsi> removed;
+    {
+        std::lock_guard lock (shard.mutex);
+        const auto now = std::chrono::steady_clock::now ();
+        while (shard.oldest && removed.size () < max) {
+            const auto imsi = shard.oldest->imsi;
+            unlink (shard, *shard.oldest);
+            shard.sessions.erase (imsi);
+            presence_erase (shard, imsi);
+            journal (shard, imsi, now, true);
+            removed.push_back (imsi);
+        }
+        shard.size.store (shard.sessions.size (), std::memory_order_relaxed);
+    }
+    for (const auto& imsi : removed) {
+        _cdr_writer.write (imsi, Common::CdrAction::offload, static_cast<uint16_t> (shard_index));
+        _logger->info ("Session removed (offload): {}", imsi);
+    }
+    return removed.size ();
+}
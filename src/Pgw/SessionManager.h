@@ -1,37 +1,198 @@
 #pragma once
+#include "../Common/Imsi.h"
 #include "CdrWriter.h"
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 
 class CdrWriter;
 
 class SessionManager {
     public:
-    explicit SessionManager (size_t timeout_sec, CdrWriter& writer, const std::shared_ptr<spdlog::logger>& logger);
+    static constexpr std::size_t DEFAULT_SHARDS = 64;
+    static constexpr std::size_t MAX_SHARDS     = 1 << 15;
+    // A refresh is journaled only once the session's last journaled time is this fraction of the timeout old, so a
+    // session restored from the journal expires at most timeout / JOURNAL_REFRESH_DIVISOR early.
+    static constexpr unsigned JOURNAL_REFRESH_DIVISOR = 16;
+
+    // A live session as of its last refresh or, in the journal, an attach (create or refresh) or a detach.
+    struct SessionEvent {
+        Common::Imsi imsi;
+        std::chrono::steady_clock::time_point at;
+        bool removed = false;
+    };
+
+    explicit SessionManager (size_t timeout_sec,
+    CdrWriter& writer,
+    const std::shared_ptr<spdlog::logger>& logger,
+    std::size_t shard_count = DEFAULT_SHARDS);
     ~SessionManager () = default;
 
-    bool create_session (const std::string& imsi);
+    bool create_session (const Common::Imsi& imsi);
+
+    // Refreshes imsi only if it already has a session; never creates one. Returns whether it had.
+    bool refresh_session (const Common::Imsi& imsi);
+
+    // Lock-free; safe to call from any number of threads without contending with the packet workers.
+    bool has_session (const Common::Imsi& imsi) const;
+
+    // A lookup in progress on one shard: presence tables retired while it lives stay allocated until it ends.
+    // has_session and collect_shard hold one per call.
+    class PresenceReader;
 
-    bool has_session (const std::string& imsi) const;
+    // Presence tables of one shard retired by rebuilds and not freed yet.
+    std::size_t retired_presence_tables (std::size_t shard) const;
 
     void remove_timeout ();
 
-    bool remove_session (const std::string& imsi, std::string_view reason);
+    bool remove_session (const Common::Imsi& imsi, Common::CdrAction reason = Common::CdrAction::removed);
 
     size_t session_count () const;
 
-    bool pop_one (std::string& imsi_out);
+    // Sessions evicted by remove_timeout so far.
+    uint64_t timeouts () const {
+        return _timeouts.load (std::memory_order_relaxed);
+    }
+
+    bool pop_one (Common::Imsi& imsi_out);
+
+    // Offloads up to max of the shard's least recently refreshed sessions under one lock acquisition. Returns the
+    // number removed.
+    std::size_t offload_batch (std::size_t shard, std::size_t max);
+
+    // Session table shard holding imsi; tags CDRs.
+    uint16_t shard_of (const Common::Imsi& imsi) const;
+
+    std::size_t shard_count () const {
+        return _shards.size ();
+    }
+
+    // Appends the sessions of one shard without locking it. Sessions that exist for the whole call are always
+    // included; ones created or removed meanwhile may or may not be.
+    void collect_shard (std::size_t shard, std::vector<Common::Imsi>& out) const;
+
+    // While on, every create and removal, and refreshes spaced by JOURNAL_REFRESH_DIVISOR, are also queued per shard
+    // for take_journal; SessionStore persists them.
+    void set_journaling (bool on) {
+        _journaling.store (on, std::memory_order_relaxed);
+    }
+
+    // Replaces out with the journal queued by one shard, oldest first. The shard keeps out's old buffer, so a caller
+    // that reuses out keeps both from reallocating once they have grown to the usual flush size.
+    void take_journal (std::size_t shard, std::vector<SessionEvent>& out);
+
+    // Under one lock: appends the shard's sessions (oldest refresh first) to sessions and takes its queued journal
+    // into journal as take_journal does, so the journal left behind holds exactly what happened after the copy.
+    void capture_shard (std::size_t shard, std::vector<SessionEvent>& sessions, std::vector<SessionEvent>& journal);
+
+    // Bulk load for warm restart, before the data plane starts: no CDRs, one presence table build per shard, shards
+    // filled in parallel. IMSIs already present keep their session. Returns the number of sessions added.
+    std::size_t restore (const std::vector<SessionEvent>& sessions);
 
     private:
+    // Sessions of a shard are also chained in refresh order (oldest first), so expiry only touches expired entries
+    // and a refresh is an O(1) move to the tail. unordered_map keeps element addresses stable across rehashes.
     struct SessionInfo {
         std::chrono::steady_clock::time_point start_time;
+        std::chrono::steady_clock::time_point journaled; // start_time last queued to the journal
+        Common::Imsi imsi;
+        SessionInfo* prev = nullptr;
+        SessionInfo* next = nullptr;
+    };
+
+    // Open-addressed copy of a shard's keys (Imsi::raw, linear probing, at most half full) that has_session reads
+    // without the shard mutex. Only writers holding the mutex change it; a rebuild publishes a new table and retires
+    // the old one. Lookups register in one of two counters by epoch parity, and a later write frees retired tables
+    // once the counter of the epoch before the current one drains; new lookups never join it, so it always does.
+    struct PresenceTable {
+        static constexpr uint64_t EMPTY     = 0;
+        static constexpr uint64_t TOMBSTONE = 0xF0; // length 0, so never a valid Imsi
+
+        explicit PresenceTable (std::size_t capacity) : slots (capacity), mask (capacity - 1) {
+        }
+
+        std::vector<std::atomic<uint64_t> > slots;
+        const std::size_t mask;
+        std::size_t used = 0; // live keys plus tombstones
+    };
+
+    struct RetiredPresence {
+        std::unique_ptr<PresenceTable> table;
+        uint64_t epoch; // current when it was retired
+    };
+
+    struct alignas (64) Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<Common::Imsi, SessionInfo> sessions;
+        SessionInfo* oldest = nullptr;
+        SessionInfo* newest = nullptr;
+        std::atomic<std::size_t> size{ 0 };
+        std::atomic<const PresenceTable*> presence{ nullptr };
+        std::unique_ptr<PresenceTable> presence_owner;
+        std::vector<RetiredPresence> presence_retired;
+        std::vector<SessionEvent> journal;
+        // Own cache line: bumped by every lookup, so it must not share one with the fields the data plane writes.
+        alignas (64) mutable std::array<std::atomic<std::size_t>, 2> readers{};
+        std::atomic<uint64_t> epoch{ 1 };
     };
+
+    void journal (Shard& shard, const Common::Imsi& imsi, std::chrono::steady_clock::time_point at, bool removed);
+
+    // Moves info to the tail of the refresh chain at now and journals it if its last journaled time is old enough.
+    void refresh (Shard& shard, SessionInfo& info, std::chrono::steady_clock::time_point now);
+
+    static void link_newest (Shard& shard, SessionInfo& info);
+
+    static void unlink (Shard& shard, SessionInfo& info);
+
+    // Presence table maintenance; callers hold the shard mutex.
+    static void presence_insert (Shard& shard, const Common::Imsi& imsi);
+
+    static void presence_erase (Shard& shard, const Common::Imsi& imsi);
+
+    static void presence_rebuild (Shard& shard);
+
+    // Frees the retired tables no lookup can still hold, then moves the epoch on if some are left.
+    static void presence_reclaim (Shard& shard);
+
+    Shard& shard_for (const Common::Imsi& imsi);
+
+    const Shard& shard_for (const Common::Imsi& imsi) const;
+
+    uint16_t shard_index (const Shard& shard) const;
+
     size_t _timeout_sec = 0;
-    mutable std::mutex _mutex;
-    std::unordered_map<std::string, SessionInfo> _sessions;
+    std::chrono::steady_clock::duration _journal_refresh_interval;
+    std::vector<Shard> _shards;
+    unsigned _shard_bits = 0;
+    std::atomic<std::size_t> _pop_cursor{ 0 };
+    std::atomic<uint64_t> _timeouts{ 0 };
+    std::atomic<bool> _journaling{ false };
     CdrWriter& _cdr_writer;
     std::shared_ptr<spdlog::logger> _logger;
 };
+
+class SessionManager::PresenceReader {
+    public:
+    PresenceReader (const SessionManager& sessions, std::size_t shard);
+
+    ~PresenceReader ();
+
+    PresenceReader (const PresenceReader&) = delete;
+
+    PresenceReader& operator= (const PresenceReader&) = delete;
+
+    private:
+    friend class SessionManager;
+
+    explicit PresenceReader (const Shard& shard);
+
+    const Shard& _shard;
+    std::size_t _parity = 0;
+};
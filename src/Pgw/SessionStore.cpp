@@ -0,0 +1,315 @@
+#include "SessionStore.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+// Both files, host byte order: FileHeader | Record... A snapshot holds count records, one per session. A journal
+// holds attaches and detaches in the order each shard queued them; a torn last record is ignored.
+struct FileHeader {
+    static constexpr char SNAPSHOT_MAGIC[8] = { 'P', 'G', 'W', 'S', 'N', 'A', 'P', '\0' };
+    static constexpr char JOURNAL_MAGIC[8]  = { 'P', 'G', 'W', 'J', 'R', 'N', 'L', '\0' };
+    static constexpr uint32_t VERSION       = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t generation;
+    uint64_t count;
+    int64_t written_epoch_ms;
+    uint64_t reserved[3];
+};
+
+struct Record {
+    uint64_t imsi;
+    int64_t epoch_ms; // of the last refresh; REMOVED for a journal detach
+};
+
+constexpr int64_t REMOVED = -1;
+
+static_assert (sizeof (FileHeader) == 64 && std::is_trivially_copyable_v<FileHeader>);
+static_assert (sizeof (Record) == 16);
+
+FileHeader make_header (const char (&magic)[8], const uint64_t generation, const int64_t epoch_ms) {
+    FileHeader header{};
+    std::memcpy (header.magic, magic, sizeof header.magic);
+    header.version          = FileHeader::VERSION;
+    header.record_size      = sizeof (Record);
+    header.generation       = generation;
+    header.written_epoch_ms = epoch_ms;
+    return header;
+}
+
+// Read-only private mapping of a whole file; empty when the file is missing or empty.
+struct Mapping {
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+    explicit Mapping (const std::filesystem::path& path) {
+        const int fd = open (path.c_str (), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd == -1)
+            return;
+        if (fstat (fd, &st) == 0 && st.st_size > 0) {
+            void* base = mmap (nullptr, static_cast<std::size_t> (st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base != MAP_FAILED) {
+                data = static_cast<const char*> (base);
+                size = static_cast<std::size_t> (st.st_size);
+                madvise (base, size, MADV_SEQUENTIAL);
+            }
+        }
+        close (fd);
+    }
+
+    ~Mapping () {
+        if (data)
+            munmap (const_cast<char*> (data), size);
+    }
+
+    Mapping (const Mapping&) = delete;
+
+    Mapping& operator= (const Mapping&) = delete;
+
+    // Header if the file starts with one of this kind, else nullptr.
+    const FileHeader* header (const char (&magic)[8]) const {
+        const auto* h = reinterpret_cast<const FileHeader*> (data);
+        if (size < sizeof (FileHeader) || std::memcmp (h->magic, magic, sizeof h->magic) != 0
+        || h->version != FileHeader::VERSION || h->record_size != sizeof (Record))
+            return nullptr;
+        return h;
+    }
+
+    const Record* records () const {
+        return reinterpret_cast<const Record*> (data + sizeof (FileHeader));
+    }
+
+    std::size_t record_count () const {
+        return (size - sizeof (FileHeader)) / sizeof (Record);
+    }
+};
+
+bool write_all (const int fd, const std::string& data) {
+    for (std::size_t done = 0; done < data.size ();) {
+        const ssize_t rc = ::write (fd, data.data () + done, data.size () - done);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        done += static_cast<std::size_t> (rc);
+    }
+    return true;
+}
+
+void append_record (std::string& out, const Record& record) {
+    out.append (reinterpret_cast<const char*> (&record), sizeof record);
+}
+} // namespace
+
+SessionStore::SessionStore (const Common::ServerSettings& settings,
+SessionManager& sessions,
+const std::shared_ptr<spdlog::logger>& logger)
+: _sessions (sessions), _logger (logger), _path (settings.session_snapshot_file),
+  _journal_path (settings.session_snapshot_file + ".journal"), _journal (settings.session_journal),
+  _journal_fsync (settings.session_journal_fsync),
+  _timeout (settings.session_timeout_sec), _snapshot_interval (settings.session_snapshot_interval_sec),
+  _flush_interval (std::max<std::size_t> (settings.session_journal_flush_interval_ms, 1)),
+  _steady_anchor (std::chrono::steady_clock::now ()), _system_anchor (std::chrono::system_clock::now ()) {
+}
+
+SessionStore::~SessionStore () {
+    stop ();
+    if (_journal_fd != -1)
+        close (_journal_fd);
+}
+
+int64_t SessionStore::to_epoch_ms (const std::chrono::steady_clock::time_point at) const {
+    using namespace std::chrono;
+    const auto wall = _system_anchor + duration_cast<system_clock::duration> (at - _steady_anchor);
+    return duration_cast<milliseconds> (wall.time_since_epoch ()).count ();
+}
+
+std::chrono::steady_clock::time_point SessionStore::from_epoch_ms (const int64_t epoch_ms) const {
+    using namespace std::chrono;
+    const system_clock::time_point wall{ duration_cast<system_clock::duration> (milliseconds (epoch_ms)) };
+    return _steady_anchor + duration_cast<steady_clock::duration> (wall - _system_anchor);
+}
+
+std::size_t SessionStore::restore () {
+    const auto started = std::chrono::steady_clock::now ();
+    const Mapping snapshot (_path);
+    const Mapping journal (_journal_path);
+    const auto* snapshot_header = snapshot.header (FileHeader::SNAPSHOT_MAGIC);
+    const bool corrupt          = snapshot.data
+    && (!snapshot_header || snapshot.size != sizeof (FileHeader) + snapshot_header->count * sizeof (Record));
+    if (corrupt) {
+        _logger->error ("Session snapshot {} is corrupt or of another version, starting empty", _path.string ());
+        return 0;
+    }
+
+    std::lock_guard lock (_mutex);
+    _generation = snapshot_header ? snapshot_header->generation : 0;
+
+    // Last journal event per IMSI; it overrides the snapshot. A journal of another generation is already contained
+    // in the snapshot (or predates it) and is skipped.
+    std::unordered_map<uint64_t, int64_t> replayed;
+    const auto* journal_header = journal.header (FileHeader::JOURNAL_MAGIC);
+    if (journal_header && journal_header->generation == _generation) {
+        replayed.reserve (journal.record_count ());
+        for (std::size_t i = 0; i < journal.record_count (); ++i)
+            replayed[journal.records ()[i].imsi] = journal.records ()[i].epoch_ms;
+    }
+
+    const int64_t expired_ms = to_epoch_ms (started) - std::chrono::milliseconds (_timeout).count ();
+    std::vector<SessionManager::SessionEvent> restored;
+    restored.reserve ((snapshot_header ? snapshot_header->count : 0) + replayed.size ());
+    for (std::size_t i = 0; snapshot_header && i < snapshot_header->count; ++i) {
+        const auto& r = snapshot.records ()[i];
+        if (r.epoch_ms > expired_ms && !replayed.contains (r.imsi))
+            restored.push_back ({ Common::Imsi::from_raw (r.imsi), from_epoch_ms (r.epoch_ms) });
+    }
+    for (const auto& [imsi, epoch_ms] : replayed)
+        if (epoch_ms != REMOVED && epoch_ms > expired_ms)
+            restored.push_back ({ Common::Imsi::from_raw (imsi), from_epoch_ms (epoch_ms) });
+
+    const std::size_t added = _sessions.restore (restored);
+    _logger->info ("Restored {} sessions (snapshot generation {}, {} journal records) in {} ms", added, _generation,
+    replayed.size (),
+    std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - started).count ());
+    return added;
+}
+
+void SessionStore::start () {
+    _sessions.set_journaling (_journal);
+    snapshot ();
+    _thread = std::thread (&SessionStore::run, this);
+}
+
+void SessionStore::stop () {
+    std::call_once (_stopped, [this] {
+        // Off first, so everything queued until now is in the final flush or the snapshot.
+        _sessions.set_journaling (false);
+        {
+            std::lock_guard lock (_run_mutex);
+            _stopping = true;
+        }
+        _run_cv.notify_all ();
+        if (_thread.joinable ()) {
+            _thread.join ();
+            flush_journal ();
+            snapshot ();
+        }
+    });
+}
+
+void SessionStore::run () {
+    const auto tick = _journal ? _flush_interval : std::chrono::milliseconds (_snapshot_interval);
+    auto next_snapshot = std::chrono::steady_clock::now () + _snapshot_interval;
+    std::unique_lock lock (_run_mutex);
+    if (tick.count () == 0) {
+        _run_cv.wait (lock, [this] { return _stopping; });
+        return;
+    }
+    while (!_run_cv.wait_for (lock, tick, [this] { return _stopping; })) {
+        lock.unlock ();
+        if (_journal)
+            flush_journal ();
+        const auto now = std::chrono::steady_clock::now ();
+        if (_snapshot_interval.count () > 0 && now >= next_snapshot) {
+            snapshot ();
+            next_snapshot = now + _snapshot_interval;
+        }
+        lock.lock ();
+    }
+}
+
+bool SessionStore::snapshot () {
+    std::lock_guard lock (_mutex);
+    const auto started = std::chrono::steady_clock::now ();
+    _buffer.assign (sizeof (FileHeader), '\0');
+    uint64_t count = 0;
+    for (std::size_t shard = 0; shard < _sessions.shard_count (); ++shard) {
+        _captured.clear ();
+        _sessions.capture_shard (shard, _captured, _events);
+        // Queued before the copy, so part of the old generation.
+        append_journal (_events);
+        for (const auto& s : _captured)
+            append_record (_buffer, { s.imsi.raw (), to_epoch_ms (s.at) });
+        count += _captured.size ();
+    }
+    write_journal ();
+    auto header  = make_header (FileHeader::SNAPSHOT_MAGIC, _generation + 1, to_epoch_ms (started));
+    header.count = count;
+    std::memcpy (_buffer.data (), &header, sizeof header);
+
+    const auto tmp = _path.string () + ".tmp";
+    const int fd   = open (tmp.c_str (), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok        = fd != -1 && write_all (fd, _buffer) && fdatasync (fd) == 0;
+    if (fd != -1)
+        ok = close (fd) == 0 && ok;
+    ok = ok && rename (tmp.c_str (), _path.c_str ()) == 0;
+    if (!ok) {
+        // The journal keeps running on the previous generation, which still matches the snapshot on disk.
+        _logger->error ("Cannot write session snapshot {}", _path.string ());
+        return false;
+    }
+
+    ++_generation;
+    if (_journal && !open_journal ())
+        _logger->error ("Cannot open session journal {}", _journal_path.string ());
+    _logger->info ("Session snapshot {} written: {} sessions in {} ms", _generation, count,
+    std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - started).count ());
+    return true;
+}
+
+bool SessionStore::open_journal () {
+    if (_journal_fd != -1)
+        close (_journal_fd);
+    _journal_fd = open (_journal_path.c_str (), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (_journal_fd == -1)
+        return false;
+    const auto now    = to_epoch_ms (std::chrono::steady_clock::now ());
+    const auto header = make_header (FileHeader::JOURNAL_MAGIC, _generation, now);
+    if (!write_all (_journal_fd, std::string (reinterpret_cast<const char*> (&header), sizeof header))) {
+        close (_journal_fd);
+        _journal_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void SessionStore::flush_journal () {
+    if (!_journal)
+        return;
+    std::lock_guard lock (_mutex);
+    // Taken even without an open journal, so the per-shard queues cannot grow without bound.
+    for (std::size_t shard = 0; shard < _sessions.shard_count (); ++shard) {
+        _sessions.take_journal (shard, _events);
+        append_journal (_events);
+    }
+    write_journal ();
+}
+
+void SessionStore::append_journal (const std::vector<SessionManager::SessionEvent>& events) {
+    if (_journal_fd == -1)
+        return;
+    for (const auto& e : events)
+        append_record (_journal_buffer, { e.imsi.raw (), e.removed ? REMOVED : to_epoch_ms (e.at) });
+}
+
+void SessionStore::write_journal () {
+    if (_journal_fd != -1 && !_journal_buffer.empty ()) {
+        if (!write_all (_journal_fd, _journal_buffer))
+            _logger->error ("Cannot append {} records to session journal {}", _journal_buffer.size () / sizeof (Record),
+            _journal_path.string ());
+        else if (_journal_fsync && fdatasync (_journal_fd) != 0)
+            _logger->error ("Cannot sync session journal {}", _journal_path.string ());
+    }
+    _journal_buffer.clear ();
+}
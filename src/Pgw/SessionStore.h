@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Common/ConfigLoader.h"
+#include "SessionManager.h"
+#include "spdlog/logger.h"
+
+// Warm restart for the session table. A background thread snapshots the sessions into a compact binary file
+// (header and 16-byte records, replaced by rename), copying one shard at a time so no shard is locked for longer
+// than it takes to copy its own sessions. With session_journal on, every attach and detach queued by
+// SessionManager is appended to <snapshot>.journal between snapshots, so a process crash loses at most one flush
+// interval (and refresh times by up to the session timeout / SessionManager::JOURNAL_REFRESH_DIVISOR). A host crash
+// can lose everything since the snapshot unless session_journal_fsync syncs the journal on every flush.
+//
+// Each snapshot starts a new journal generation: the journal events a shard queued before its copy are written to
+// the old journal, the rest go to the new one. A journal is only replayed on top of the snapshot of its generation.
+class SessionStore {
+    public:
+    SessionStore (const Common::ServerSettings& settings,
+    SessionManager& sessions,
+    const std::shared_ptr<spdlog::logger>& logger);
+
+    // Calls stop ().
+    ~SessionStore ();
+
+    SessionStore (const SessionStore&) = delete;
+
+    SessionStore& operator= (const SessionStore&) = delete;
+
+    // Maps the snapshot, replays its journal and loads every unexpired session into the manager. Call before the
+    // data plane starts. Returns the number of sessions restored.
+    std::size_t restore ();
+
+    // Starts journaling, writes a snapshot of the restored table and launches the snapshot/journal thread.
+    void start ();
+
+    // Turns journaling off, stops the thread and writes a final snapshot, so a warm restart gets the table as it is
+    // now. Call before a graceful offload starts emptying it; later changes are not persisted. Runs once, and
+    // concurrent callers wait for it to finish.
+    void stop ();
+
+    bool snapshot ();
+
+    void flush_journal ();
+
+    uint64_t generation () const {
+        std::lock_guard lock (_mutex);
+        return _generation;
+    }
+
+    private:
+    void run ();
+
+    bool open_journal ();
+
+    // Encodes events into _journal_buffer; write_journal appends it to the journal file in one go.
+    void append_journal (const std::vector<SessionManager::SessionEvent>& events);
+
+    void write_journal ();
+
+    int64_t to_epoch_ms (std::chrono::steady_clock::time_point at) const;
+
+    std::chrono::steady_clock::time_point from_epoch_ms (int64_t epoch_ms) const;
+
+    SessionManager& _sessions;
+    std::shared_ptr<spdlog::logger> _logger;
+    const std::filesystem::path _path;
+    const std::filesystem::path _journal_path;
+    const bool _journal;
+    const bool _journal_fsync;
+    const std::chrono::seconds _timeout;
+    const std::chrono::seconds _snapshot_interval;
+    const std::chrono::milliseconds _flush_interval;
+    // steady_clock and system_clock at construction; session times are kept in steady_clock.
+    const std::chrono::steady_clock::time_point _steady_anchor;
+    const std::chrono::system_clock::time_point _system_anchor;
+
+    mutable std::mutex _mutex; // serializes snapshots and journal writes
+    uint64_t _generation = 0;
+    int _journal_fd      = -1;
+    // Reused across flushes and snapshots, so neither allocates once grown.
+    std::vector<SessionManager::SessionEvent> _events;
+    std::vector<SessionManager::SessionEvent> _captured;
+    std::string _buffer;
+    std::string _journal_buffer;
+
+    std::mutex _run_mutex;
+    std::condition_variable _run_cv;
+    bool _stopping = false;
+    std::once_flag _stopped;
+    std::thread _thread;
+};
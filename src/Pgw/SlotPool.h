@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+#include "boost/lockfree/queue.hpp"
+
+namespace Pgw {
+// Fixed set of slots allocated once and recycled through a lock-free free list.
+template <typename T, std::size_t Capacity> class SlotPool {
+    public:
+    SlotPool () : _slots (std::make_unique<T[]> (Capacity)) {
+        for (std::size_t i = 0; i < Capacity; ++i)
+            _free.bounded_push (&_slots[i]);
+    }
+
+    SlotPool (const SlotPool&) = delete;
+
+    SlotPool& operator= (const SlotPool&) = delete;
+
+    T* acquire () {
+        T* slot{};
+        if (!_free.pop (slot)) {
+            _exhausted.fetch_add (1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return slot;
+    }
+
+    void release (T* slot) {
+        if (slot)
+            _free.bounded_push (slot);
+    }
+
+    bool owns (const T* slot) const {
+        return slot >= _slots.get () && slot < _slots.get () + Capacity;
+    }
+
+    std::size_t exhausted () const {
+        return _exhausted.load (std::memory_order_relaxed);
+    }
+
+    static constexpr std::size_t capacity () {
+        return Capacity;
+    }
+
+    private:
+    std::unique_ptr<T[]> _slots;
+    boost::lockfree::queue<T*, boost::lockfree::capacity<Capacity> > _free;
+    std::atomic<std::size_t> _exhausted{ 0 };
+};
+} // namespace Pgw
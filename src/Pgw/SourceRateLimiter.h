@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Pgw {
+// Token bucket per source IPv4 address for one shard's receive thread, so it needs no locking. Buckets live in a
+// fixed open-addressed table of 16-byte entries probed over a short window; a new source that finds its window full
+// takes the entry idle the longest, so memory stays bounded however many addresses a storm comes from.
+class SourceRateLimiter {
+    public:
+    static constexpr std::size_t PROBE_WINDOW = 8;
+
+    // rate 0 admits everything.
+    SourceRateLimiter (const double rate, const double burst, const std::size_t capacity)
+    : _rate (rate), _burst (std::max (burst, 1.0)),
+      _table (enabled () ? std::bit_ceil (std::max (capacity, PROBE_WINDOW)) : 0),
+      _shift (_table.empty () ? 0 : 64 - std::countr_zero (_table.size ())) {
+    }
+
+    bool enabled () const {
+        return _rate > 0;
+    }
+
+    // Takes a token from addr's bucket (network byte order) at steady time now_ns > 0.
+    bool admit (const uint32_t addr, const int64_t now_ns) {
+        if (!enabled ())
+            return true;
+        const std::size_t mask = _table.size () - 1;
+        const std::size_t home = static_cast<std::size_t> ((addr * 0x9E3779B97F4A7C15ull) >> _shift);
+        Entry* victim          = nullptr;
+        for (std::size_t i = 0; i < PROBE_WINDOW; ++i) {
+            auto& e = _table[(home + i) & mask];
+            if (e.last_ns != 0 && e.addr == addr) {
+                const double elapsed = static_cast<double> (now_ns - e.last_ns) / 1e9;
+                e.tokens             = static_cast<float> (std::min (_burst, e.tokens + _rate * elapsed));
+                e.last_ns            = now_ns;
+                if (e.tokens < 1)
+                    return false;
+                e.tokens -= 1;
+                return true;
+            }
+            if (!victim || e.last_ns < victim->last_ns)
+                victim = &e; // an empty entry (last_ns 0) always wins
+        }
+        *victim = { addr, static_cast<float> (_burst - 1), now_ns };
+        return true;
+    }
+
+    std::size_t capacity () const {
+        return _table.size ();
+    }
+
+    std::size_t tracked () const {
+        return static_cast<std::size_t> (
+        std::count_if (_table.begin (), _table.end (), [] (const Entry& e) { return e.last_ns != 0; }));
+    }
+
+    private:
+    struct Entry {
+        uint32_t addr   = 0;
+        float tokens    = 0;
+        int64_t last_ns = 0; // of the last packet; 0 marks a free entry
+    };
+
+    static_assert (sizeof (Entry) == 16);
+
+    const double _rate;
+    const double _burst;
+    std::vector<Entry> _table;
+    const unsigned _shift;
+};
+} // namespace Pgw
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "../Common/Clock.h"
+
+namespace Pgw {
+// Points a request passes on its way through a shard, in order. Each stage after the first closes the interval
+// named by trace_interval_name.
+enum class TraceStage : uint8_t { received, dequeued, decoded, blacklist, session, cdr, queued, sent };
+
+constexpr std::size_t TRACE_STAGES = 8;
+
+constexpr std::string_view trace_interval_name (const TraceStage stage) {
+    constexpr std::array<std::string_view, TRACE_STAGES> names = { "", "recv_queue", "decode", "blacklist", "session",
+        "cdr", "respond", "send" };
+    return names[static_cast<std::size_t> (stage)];
+}
+
+using Common::steady_now_ns;
+
+// Stage timestamps carried with a request and its response. Built without PGW_ENABLE_TRACING this is an empty
+// type ([[no_unique_address]] in the slots) and stamp () does nothing, so the hot path is unchanged.
+#ifdef PGW_ENABLE_TRACING
+constexpr bool TRACING_ENABLED = true;
+
+struct PacketTrace {
+    std::array<int64_t, TRACE_STAGES> at{};
+
+    void stamp (const TraceStage stage) {
+        at[static_cast<std::size_t> (stage)] = steady_now_ns ();
+    }
+
+    void stamp (const TraceStage stage, const int64_t ns) {
+        at[static_cast<std::size_t> (stage)] = ns;
+    }
+
+    int64_t interval (const TraceStage stage) const {
+        const auto i = static_cast<std::size_t> (stage);
+        return at[i] - at[i - 1];
+    }
+};
+#else
+constexpr bool TRACING_ENABLED = false;
+
+struct PacketTrace {
+    void stamp (TraceStage) {
+    }
+
+    void stamp (TraceStage, int64_t) {
+    }
+};
+#endif
+} // namespace Pgw
@@ -1,5 +1,9 @@
 #include "UdpServer.h"
 
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <pthread.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 
@@ -11,16 +15,68 @@
 
 using namespace Pgw;
 
+namespace {
+// Counters below have a single writer, so a relaxed load/store pair is enough and avoids a locked RMW.
+void bump (std::atomic<uint64_t>& counter, const uint64_t n = 1) {
+    counter.store (counter.load (std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+uint64_t load (const std::atomic<uint64_t>& counter) {
+    return counter.load (std::memory_order_relaxed);
+}
+
+// Producer and consumer counters are read at slightly different moments, so the difference can briefly go negative.
+uint64_t depth (const uint64_t queued, const uint64_t taken) {
+    return queued > taken ? queued - taken : 0;
+}
+} // namespace
+
 UdpServer::UdpServer (const Common::ServerSettings& settings,
 std::shared_ptr<ControlPlaneServer> control_plane_server,
 std::shared_ptr<SessionManager> session_manager,
 std::shared_ptr<BlackListStorer> black_list_storer,
 std::shared_ptr<CdrWriter> cdr_writer)
-: _bind_ip (settings.udp_ip), _bind_port (settings.udp_port), _graceful_shutdown_rate (settings.graceful_shutdown_rate),
+: _bind_ip (settings.udp_ip), _bind_port (settings.udp_port),
+  _batch_size (std::clamp<std::size_t> (settings.udp_batch_size, 1, MAX_IO_BATCH)),
+  _io_uring (settings.udp_io_backend == "io_uring"),
+  _run_to_completion (settings.udp_pipeline == "run_to_completion"),
+  _flush_timeout (settings.udp_flush_timeout_us),
+  _expiry_tick (std::max<std::size_t> (settings.session_timeout_granularity_ms, 1)),
+  _slow_trace_threshold (std::chrono::microseconds (settings.trace_slow_us)),
+  _queue_watermark (settings.admission_queue_watermark),
   _http (std::move (control_plane_server)), _sessions (std::move (session_manager)),
   _blacklist (std::move (black_list_storer)), _cdr (std::move (cdr_writer)),
   _logger (Common::make_file_logger (settings, "server_log", settings.log_file)) {
+    if (!_io_uring && settings.udp_io_backend != "epoll")
+        throw std::invalid_argument ("Unknown udp_io_backend: " + settings.udp_io_backend);
+    if (!_run_to_completion && settings.udp_pipeline != "staged")
+        throw std::invalid_argument ("Unknown udp_pipeline: " + settings.udp_pipeline);
+    if (_run_to_completion && _io_uring)
+        throw std::invalid_argument ("udp_pipeline run_to_completion needs udp_io_backend epoll");
+    const auto& cpus         = settings.udp_shard_cpus;
+    const std::size_t shards = std::max<std::size_t> (settings.udp_shards, 1);
+    _shards.reserve (shards);
+    for (std::size_t i = 0; i < shards; ++i) {
+        const int cpu = cpus.empty () ? -1 : cpus[i % cpus.size ()];
+        auto& shard   = _shards.emplace_back (std::make_unique<Shard> (i, cpu,
+        SourceRateLimiter (static_cast<double> (settings.admission_source_rate),
+        static_cast<double> (settings.admission_source_burst), settings.admission_source_table)));
+        if (_batch_size > 1 || _run_to_completion) {
+            shard->rx_slots.assign (_batch_size, nullptr);
+            shard->rx_msgs.resize (_batch_size);
+            shard->rx_iov.resize (_batch_size);
+        }
+        if (_batch_size > 1 || _io_uring || _run_to_completion) {
+            shard->tx_pending.reserve (_batch_size);
+            shard->tx_msgs.resize (_batch_size);
+            shard->tx_iov.resize (_batch_size);
+        }
+    }
+    _offload = std::make_unique<OffloadScheduler> (*_sessions, settings.graceful_shutdown_rate,
+    std::chrono::microseconds (settings.graceful_offload_tick_us), _logger);
     _blacklist->store (settings.blacklist);
+    if (!TRACING_ENABLED && settings.trace_slow_us > 0)
+        _logger->warn ("trace_slow_us is set but this build has no PGW_ENABLE_TRACING; slow packets are not traced");
 }
 
 UdpServer::~UdpServer () {
@@ -30,64 +86,209 @@ UdpServer::~UdpServer () {
 void UdpServer::start () {
     _running.store (true);
 
-    init_socket ();
+    for (const auto& shard : _shards)
+        init_socket (*shard);
+
     _timeout_thread = std::thread ([this] {
         while (_running) {
             _sessions->remove_timeout ();
-            std::this_thread::sleep_for (std::chrono::seconds (1));
+            std::this_thread::sleep_for (_expiry_tick);
         }
     });
-    _epoll_thread   = std::thread (&UdpServer::event_loop, this);
-    _worker_thread  = std::thread (&UdpServer::process_packets, this);
-    _sender_thread  = std::thread (&UdpServer::send_responses, this);
+    for (const auto& shard : _shards) {
+        if (_run_to_completion) {
+            shard->epoll_thread = std::thread (&UdpServer::event_loop, this, std::ref (*shard));
+            pin_thread (shard->epoll_thread, *shard);
+            continue;
+        }
+        shard->epoll_thread  = std::thread (_io_uring ? &UdpServer::uring_event_loop : &UdpServer::event_loop, this,
+        std::ref (*shard));
+        shard->worker_thread = std::thread (&UdpServer::process_packets, this, std::ref (*shard));
+        shard->sender_thread = std::thread (&UdpServer::send_responses, this, std::ref (*shard));
+        pin_thread (shard->epoll_thread, *shard);
+        pin_thread (shard->worker_thread, *shard);
+        pin_thread (shard->sender_thread, *shard);
+    }
 
-    _logger->info ("UDP‑Server started on {}:{}", _bind_ip, _bind_port);
+    _logger->info ("UDP‑Server started on {}:{} ({} shard(s), io batch {}, {}, {} pipeline)", _bind_ip, _bind_port,
+    _shards.size (), _batch_size, _io_uring ? "io_uring" : "epoll",
+    _run_to_completion ? "run-to-completion" : "staged");
 }
 
 void UdpServer::stop () {
+    // A drain in progress finishes first; sessions that are still attached keep getting answers until then.
+    _offload->wait ();
     _running.store (false);
+    for (const auto& shard : _shards) {
+        shard->worker_waiter.notify ();
+        shard->sender_waiter.notify ();
+    }
 
     _logger->info ("UDP‑Server stopping…");
 
-    const auto this_id = std::this_thread::get_id ();
-
-    if (_epoll_thread.joinable ())
-        _epoll_thread.join ();
-    if (_worker_thread.joinable ())
-        _worker_thread.join ();
-    if (_sender_thread.joinable ())
-        _sender_thread.join ();
+    for (const auto& shard : _shards) {
+        if (shard->epoll_thread.joinable ())
+            shard->epoll_thread.join ();
+        if (shard->worker_thread.joinable ())
+            shard->worker_thread.join ();
+        if (shard->sender_thread.joinable ())
+            shard->sender_thread.join ();
+    }
     if (_timeout_thread.joinable ())
         _timeout_thread.join ();
-    if (_offload_thread.joinable () && _offload_thread.get_id () != this_id)
-        _offload_thread.join ();
 
-    if (_udp_fd != -1) {
-        close (_udp_fd);
-        _udp_fd = -1;
-    }
-    if (_epoll_fd != -1) {
-        close (_epoll_fd);
-        _epoll_fd = -1;
+    for (const auto& shard : _shards) {
+        for (auto*& pkt : shard->rx_slots) {
+            shard->packet_pool.release (pkt);
+            pkt = nullptr;
+        }
+        if (shard->udp_fd != -1) {
+            close (shard->udp_fd);
+            shard->udp_fd = -1;
+        }
+        if (shard->epoll_fd != -1) {
+            close (shard->epoll_fd);
+            shard->epoll_fd = -1;
+        }
     }
 
     _logger->info ("UDP‑Server stopped.");
 }
 
 
+IoStats UdpServer::io_stats () const {
+    IoStats stats;
+    for (const auto& shard : _shards) {
+        stats.rx_syscalls += shard->rx_syscalls.load (std::memory_order_relaxed);
+        stats.rx_packets += shard->rx_packets.load (std::memory_order_relaxed);
+        stats.tx_syscalls += shard->tx_syscalls.load (std::memory_order_relaxed);
+        stats.tx_packets += shard->tx_packets.load (std::memory_order_relaxed);
+        stats.pool_exhausted += shard->packet_pool.exhausted () + shard->response_pool.exhausted ();
+        stats.rx_dropped += shard->rx_dropped.load (std::memory_order_relaxed);
+        stats.tx_dropped += shard->tx_dropped.load (std::memory_order_relaxed);
+        stats.rx_malformed += shard->rx_malformed.load (std::memory_order_relaxed);
+        stats.shed_source_rate += load (shard->shed_source_rate);
+        stats.shed_overload += load (shard->shed_overload);
+        stats.created += load (shard->created);
+        stats.existing += load (shard->existing);
+        stats.rejected += load (shard->rejected);
+        stats.refused += load (shard->refused);
+        stats.recv_queue_depth += depth (load (shard->rx_queued), load (shard->rx_taken));
+        stats.send_queue_depth += depth (load (shard->tx_queued), load (shard->tx_taken));
+    }
+    return stats;
+}
+
+std::size_t UdpServer::io_uring_shards () const {
+    return static_cast<std::size_t> (std::count_if (_shards.begin (), _shards.end (),
+    [] (const auto& shard) { return shard->uring_rx.load (std::memory_order_relaxed); }));
+}
+
+Common::Histogram::Snapshot UdpServer::response_latency () const {
+    Common::Histogram::Snapshot merged;
+    for (const auto& shard : _shards)
+        merged += shard->latency.snapshot ();
+    return merged;
+}
+
+Common::Histogram::Snapshot UdpServer::stage_latency ([[maybe_unused]] const TraceStage stage) const {
+    Common::Histogram::Snapshot merged;
+#ifdef PGW_ENABLE_TRACING
+    for (const auto& shard : _shards)
+        merged += shard->stage_latency[static_cast<std::size_t> (stage)].snapshot ();
+#endif
+    return merged;
+}
+
+void UdpServer::append_metrics (std::string& out) const {
+    const auto s       = io_stats ();
+    const auto offload = offload_progress ();
+    auto it            = std::back_inserter (out);
+    fmt::format_to (it,
+    "# HELP pgw_packets_received_total Datagrams read from the UDP sockets.\n"
+    "# TYPE pgw_packets_received_total counter\n"
+    "pgw_packets_received_total {}\n"
+    "# HELP pgw_packets_dropped_total Datagrams not answered, by reason.\n"
+    "# TYPE pgw_packets_dropped_total counter\n"
+    "pgw_packets_dropped_total{{reason=\"recv_queue_full\"}} {}\n"
+    "pgw_packets_dropped_total{{reason=\"send_queue_full\"}} {}\n"
+    "pgw_packets_dropped_total{{reason=\"malformed\"}} {}\n"
+    "pgw_packets_dropped_total{{reason=\"pool_exhausted\"}} {}\n"
+    "pgw_packets_dropped_total{{reason=\"source_rate\"}} {}\n"
+    "pgw_packets_dropped_total{{reason=\"overload\"}} {}\n"
+    "# HELP pgw_packets_answered_total Responses handed to the kernel.\n"
+    "# TYPE pgw_packets_answered_total counter\n"
+    "pgw_packets_answered_total {}\n"
+    "# HELP pgw_requests_total Well-formed requests by outcome.\n"
+    "# TYPE pgw_requests_total counter\n"
+    "pgw_requests_total{{result=\"created\"}} {}\n"
+    "pgw_requests_total{{result=\"exists\"}} {}\n"
+    "pgw_requests_total{{result=\"rejected\"}} {}\n"
+    "pgw_requests_total{{result=\"refused_draining\"}} {}\n"
+    "# HELP pgw_queue_depth Entries waiting in the per-shard queues.\n"
+    "# TYPE pgw_queue_depth gauge\n"
+    "pgw_queue_depth{{queue=\"recv\"}} {}\n"
+    "pgw_queue_depth{{queue=\"send\"}} {}\n"
+    "# HELP pgw_sessions Active sessions.\n"
+    "# TYPE pgw_sessions gauge\n"
+    "pgw_sessions {}\n"
+    "# HELP pgw_session_timeouts_total Sessions evicted by the inactivity timeout.\n"
+    "# TYPE pgw_session_timeouts_total counter\n"
+    "pgw_session_timeouts_total {}\n"
+    "# HELP pgw_cdr_backlog CDRs enqueued but not yet written.\n"
+    "# TYPE pgw_cdr_backlog gauge\n"
+    "pgw_cdr_backlog {}\n"
+    "# HELP pgw_cdr_queue_full_stalls_total CDR writes that waited for room in a full writer queue.\n"
+    "# TYPE pgw_cdr_queue_full_stalls_total counter\n"
+    "pgw_cdr_queue_full_stalls_total {}\n"
+    "# HELP pgw_cdr_unwritten_total CDRs discarded because the CDR file could not be opened.\n"
+    "# TYPE pgw_cdr_unwritten_total counter\n"
+    "pgw_cdr_unwritten_total {}\n"
+    "# HELP pgw_offload_removed_total Sessions removed by the graceful offload.\n"
+    "# TYPE pgw_offload_removed_total counter\n"
+    "pgw_offload_removed_total {}\n"
+    "# HELP pgw_offload_remaining Sessions the graceful offload still has to remove.\n"
+    "# TYPE pgw_offload_remaining gauge\n"
+    "pgw_offload_remaining {}\n",
+    s.rx_packets, s.rx_dropped, s.tx_dropped, s.rx_malformed, s.pool_exhausted, s.shed_source_rate, s.shed_overload,
+    s.tx_packets, s.created, s.existing, s.rejected, s.refused, s.recv_queue_depth, s.send_queue_depth,
+    _sessions->session_count (), _sessions->timeouts (), _cdr->backlog (), _cdr->queue_full_stalls (), _cdr->unwritten (),
+    offload.removed, offload.remaining);
+    Common::append_prometheus_histogram (
+    out, "pgw_response_latency_seconds", "Time from receiving a request to sending its response.", response_latency ());
+
+    if constexpr (TRACING_ENABLED) {
+        Common::append_prometheus_header (out, "pgw_stage_latency_seconds", "Time spent per processing stage.");
+        for (std::size_t i = 1; i < TRACE_STAGES; ++i) {
+            const auto stage = static_cast<TraceStage> (i);
+            Common::append_prometheus_series (out, "pgw_stage_latency_seconds",
+            fmt::format ("stage=\"{}\"", trace_interval_name (stage)), stage_latency (stage));
+        }
+    }
+}
+
 void UdpServer::initiate_graceful_shutdown () {
-    if (_graceful.exchange (true))
+    if (_offload->draining ())
         return;
 
     _logger->info ("Graceful shutdown requested");
-    _offload_thread = std::thread (&UdpServer::offload_sessions, this);
+    _offload->start ([this] {
+        _logger->info ("Graceful offload finished, stopping the data plane");
+        _running.store (false);
+    });
 }
 
-void UdpServer::init_socket () {
-    _udp_fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
-    if (_udp_fd == -1)
+void UdpServer::init_socket (Shard& shard) const {
+    shard.udp_fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (shard.udp_fd == -1)
         throw std::runtime_error ("can't create UDP socket");
 
+    if (_shards.size () > 1) {
+        constexpr int on = 1;
+        if (setsockopt (shard.udp_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == -1)
+            throw std::runtime_error ("setsockopt(SO_REUSEPORT) failed");
+    }
+
     sockaddr_in addr{};
     in_addr addr_in{};
     addr.sin_family = AF_INET;
@@ -96,117 +297,518 @@ void UdpServer::init_socket () {
         throw std::invalid_argument ("bad udp_ip " + _bind_ip);
     addr.sin_addr = addr_in;
 
-    if (bind (_udp_fd, reinterpret_cast<sockaddr*> (&addr), sizeof addr) == -1)
+    if (bind (shard.udp_fd, reinterpret_cast<sockaddr*> (&addr), sizeof addr) == -1)
         throw std::runtime_error ("bind() failed");
 
-    _epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
-    if (_epoll_fd == -1)
+    shard.epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (shard.epoll_fd == -1)
         throw std::runtime_error ("epoll_create1() failed");
 
     epoll_event ev{};
     ev.events  = EPOLLIN;
-    ev.data.fd = _udp_fd;
-    if (epoll_ctl (_epoll_fd, EPOLL_CTL_ADD, _udp_fd, &ev) == -1)
+    ev.data.fd = shard.udp_fd;
+    if (epoll_ctl (shard.epoll_fd, EPOLL_CTL_ADD, shard.udp_fd, &ev) == -1)
         throw std::runtime_error ("epoll_ctl() failed");
 }
 
-void UdpServer::event_loop () {
+void UdpServer::pin_thread (std::thread& thread, const Shard& shard) const {
+    if (shard.cpu < 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET (shard.cpu, &set);
+    if (const int rc = pthread_setaffinity_np (thread.native_handle (), sizeof set, &set); rc != 0)
+        _logger->warn ("Failed to pin shard {} to CPU {} (error {})", shard.index, shard.cpu, rc);
+}
+
+void UdpServer::event_loop (Shard& shard) {
     epoll_event evs[MAX_EPOLL_EVENTS];
 
     while (_running) {
-        const int n = epoll_wait (_epoll_fd, evs, MAX_EPOLL_EVENTS, 10);
+        const int n = epoll_wait (shard.epoll_fd, evs, MAX_EPOLL_EVENTS, 10);
         if (n <= 0)
             continue;
+        bump (shard.rx_syscalls);
 
         for (int i = 0; i < n; ++i) {
             if (!(evs[i].events & EPOLLIN))
                 continue;
+            if (_run_to_completion)
+                serve_batch (shard);
+            else if (_batch_size > 1)
+                receive_batch (shard);
+            else
+                receive_one (shard);
+        }
+    }
+}
 
-            auto* pkt     = new UdpPacket;
-            pkt->addr_len = sizeof (pkt->client_addr);
-
-            const ssize_t len = recvfrom (_udp_fd, pkt->bcd.data (), pkt->bcd.size (), MSG_DONTWAIT,
-            reinterpret_cast<sockaddr*> (&pkt->client_addr), &pkt->addr_len);
-            if (len <= 0) {
-                delete pkt;
-                continue;
+void UdpServer::uring_event_loop (Shard& shard) {
+    std::unique_ptr<IoUring> ring;
+    msghdr hdr{};
+    hdr.msg_namelen = sizeof (sockaddr_in);
+    try {
+        ring = std::make_unique<IoUring> (MAX_EPOLL_EVENTS, URING_RX_BUFFERS * 2);
+        ring->provide_buffers (URING_RX_BUFFERS, IoUring::RECVMSG_HEADER + hdr.msg_namelen + UDP_BUFFER_SIZE);
+    } catch (const std::system_error& ex) {
+        _logger->warn ("Shard {}: io_uring unavailable ({}), receiving with epoll", shard.index, ex.what ());
+        event_loop (shard);
+        return;
+    }
+    shard.uring_rx.store (true, std::memory_order_relaxed);
+
+    bool armed       = false;
+    bool unsupported = false;
+    while (_running && !unsupported) {
+        // The multishot request stays armed until the kernel ends it, e.g. when it runs out of buffers.
+        if (!armed)
+            armed = ring->recvmsg_multishot (shard.udp_fd, &hdr, 0);
+        ring->submit_and_wait (1, IDLE_PARK_TIMEOUT);
+        bump (shard.rx_syscalls);
+
+        const int64_t rx_ns  = steady_now_ns ();
+        std::size_t received = 0;
+        std::size_t queued   = 0;
+        ring->drain ([&] (const IoUring::Completion& c) {
+            armed = armed && IoUring::more (c);
+            // Recycled buffers only go back to the kernel at publish_buffers, after the copy below.
+            ring->recycle_buffer (c);
+            IoUring::Datagram dgram;
+            if (!ring->parse_datagram (c, hdr, dgram)) {
+                unsupported = c.res == -EINVAL; // no multishot recvmsg before Linux 6.0
+                return;
             }
+            ++received;
+            auto* pkt = shard.packet_pool.acquire ();
+            if (!pkt) {
+                bump (shard.rx_dropped);
+                return;
+            }
+            std::memcpy (pkt->bcd.data (), dgram.payload.data (), dgram.payload.size ());
+            pkt->data_len = dgram.payload.size ();
+            pkt->addr_len = std::min<socklen_t> (dgram.name_len, sizeof (pkt->client_addr));
+            std::memcpy (&pkt->client_addr, dgram.name, pkt->addr_len);
+            pkt->rx_ns = rx_ns;
+            if (!admit (shard, *pkt, queued)) {
+                shard.packet_pool.release (pkt);
+            } else if (!shard.recv_queue.push (pkt)) {
+                shard.packet_pool.release (pkt);
+                bump (shard.rx_dropped);
+            } else {
+                ++queued;
+            }
+        });
+        ring->publish_buffers ();
+        bump (shard.rx_packets, received);
+        bump (shard.rx_queued, queued);
+        if (queued > 0)
+            shard.worker_waiter.notify ();
+    }
 
-            pkt->data_len = static_cast<std::size_t> (len);
-            while (!_recv_queue.push (pkt)) {
+    if (unsupported) {
+        _logger->warn ("Shard {}: kernel has no multishot recvmsg, receiving with epoll", shard.index);
+        ring.reset ();
+        shard.uring_rx.store (false, std::memory_order_relaxed);
+        event_loop (shard);
+    }
+}
+
+void UdpServer::receive_one (Shard& shard) {
+    auto* pkt = shard.packet_pool.acquire ();
+    if (!pkt) {
+        discard_datagram (shard);
+        return;
+    }
+    pkt->addr_len = sizeof (pkt->client_addr);
+
+    const ssize_t len = recvfrom (shard.udp_fd, pkt->bcd.data (), pkt->bcd.size (), MSG_DONTWAIT,
+    reinterpret_cast<sockaddr*> (&pkt->client_addr), &pkt->addr_len);
+    bump (shard.rx_syscalls);
+    if (len <= 0) {
+        shard.packet_pool.release (pkt);
+        return;
+    }
+
+    pkt->data_len = static_cast<std::size_t> (len);
+    pkt->rx_ns    = steady_now_ns ();
+    bump (shard.rx_packets);
+    if (!admit (shard, *pkt, 0)) {
+        shard.packet_pool.release (pkt);
+        return;
+    }
+    if (!shard.recv_queue.push (pkt)) {
+        shard.packet_pool.release (pkt);
+        bump (shard.rx_dropped);
+        return;
+    }
+    bump (shard.rx_queued);
+    shard.worker_waiter.notify ();
+}
+
+void UdpServer::receive_batch (Shard& shard) {
+    while (_running) {
+        const std::size_t slots = arm_rx_slots (shard);
+        if (slots == 0) {
+            discard_datagram (shard);
+            return;
+        }
+
+        const int n =
+        recvmmsg (shard.udp_fd, shard.rx_msgs.data (), static_cast<unsigned> (slots), MSG_DONTWAIT, nullptr);
+        bump (shard.rx_syscalls);
+        if (n <= 0)
+            return;
+
+        const int64_t rx_ns = steady_now_ns ();
+        std::size_t queued  = 0;
+        for (int i = 0; i < n; ++i) {
+            auto*& pkt    = shard.rx_slots[i];
+            pkt->data_len = shard.rx_msgs[i].msg_len;
+            pkt->addr_len = shard.rx_msgs[i].msg_hdr.msg_namelen;
+            pkt->rx_ns    = rx_ns;
+            // A shed packet keeps its slot for the next recvmmsg.
+            if (!admit (shard, *pkt, queued))
+                continue;
+            if (!shard.recv_queue.push (pkt)) {
+                // Queue full: keep the slot for the next recvmmsg and shed the datagram.
+                bump (shard.rx_dropped);
+                continue;
             }
+            pkt = nullptr;
+            ++queued;
         }
+        bump (shard.rx_packets, n);
+        bump (shard.rx_queued, queued);
+        shard.worker_waiter.notify ();
+
+        if (static_cast<std::size_t> (n) < _batch_size)
+            return;
     }
 }
 
-void UdpServer::process_packets () {
+void UdpServer::serve_batch (Shard& shard) {
     while (_running) {
-        UdpPacket* pkt{};
-        if (!_recv_queue.pop (pkt)) {
-            std::this_thread::sleep_for (std::chrono::milliseconds (1));
-            continue;
+        const std::size_t slots = arm_rx_slots (shard);
+        if (slots == 0) {
+            discard_datagram (shard);
+            return;
         }
 
-        const std::string imsi = bcd_to_imsi (pkt->bcd.data (), pkt->data_len);
+        const int n =
+        recvmmsg (shard.udp_fd, shard.rx_msgs.data (), static_cast<unsigned> (slots), MSG_DONTWAIT, nullptr);
+        bump (shard.rx_syscalls);
+        if (n <= 0)
+            return;
 
-        std::string action;
-        if (_blacklist->is_in_blacklist (imsi)) {
-            action = "rejected";
-        } else if (_sessions->create_session (imsi)) {
-            action = "created";
-        } else {
-            action = "exists";
+        // Packets stay in their slots; each is answered before the next recvmmsg reuses it.
+        const int64_t rx_ns = steady_now_ns ();
+        for (int i = 0; i < n; ++i) {
+            auto& pkt    = *shard.rx_slots[i];
+            pkt.data_len = shard.rx_msgs[i].msg_len;
+            pkt.addr_len = shard.rx_msgs[i].msg_hdr.msg_namelen;
+            pkt.rx_ns    = rx_ns;
+            if (!admit (shard, pkt, 0))
+                continue;
+            const auto action = handle_request (shard, pkt);
+            if (action.empty ())
+                continue;
+            if (auto* rsp = make_response (shard, pkt, action))
+                shard.tx_pending.push_back (rsp);
         }
-        if (action != "exists")
-            _cdr->write (imsi, action);
+        bump (shard.rx_packets, n);
+        if (!shard.tx_pending.empty ())
+            flush_responses (shard);
 
-        auto* rsp        = new UdpResponse;
-        rsp->response    = action;
-        rsp->client_addr = pkt->client_addr;
-        rsp->addr_len    = pkt->addr_len;
-        while (!_send_queue.push (rsp)) {
+        if (static_cast<std::size_t> (n) < _batch_size)
+            return;
+    }
+}
+
+std::size_t UdpServer::arm_rx_slots (Shard& shard) {
+    std::size_t slots = 0;
+    for (; slots < _batch_size; ++slots) {
+        auto*& pkt = shard.rx_slots[slots];
+        if (!pkt && !(pkt = shard.packet_pool.acquire ()))
+            break;
+        shard.rx_iov[slots] = { pkt->bcd.data (), pkt->bcd.size () };
+        auto& hdr           = shard.rx_msgs[slots].msg_hdr;
+        hdr                 = {};
+        hdr.msg_name        = &pkt->client_addr;
+        hdr.msg_namelen     = sizeof (pkt->client_addr);
+        hdr.msg_iov         = &shard.rx_iov[slots];
+        hdr.msg_iovlen      = 1;
+    }
+    return slots;
+}
+
+bool UdpServer::admit (Shard& shard, const UdpPacket& pkt, const uint64_t queued) {
+    if (!shard.limiter.admit (pkt.client_addr.sin_addr.s_addr, pkt.rx_ns)) {
+        bump (shard.shed_source_rate);
+        return false;
+    }
+    // queued: pushed by this thread but not yet added to rx_queued.
+    if (_queue_watermark == 0 || depth (load (shard.rx_queued) + queued, load (shard.rx_taken)) < _queue_watermark)
+        return true;
+    // The session lookup is lock-free, so the check stays cheap while the workers are saturated.
+    const auto imsi = Common::Imsi::from_bcd (pkt.bcd.data (), pkt.data_len);
+    if (imsi.valid () && _sessions->has_session (imsi))
+        return true;
+    bump (shard.shed_overload);
+    return false;
+}
+
+void UdpServer::discard_datagram (Shard& shard) {
+    // Out of packet slots: drop the datagram so a level-triggered epoll does not spin on it.
+    recv (shard.udp_fd, nullptr, 0, MSG_DONTWAIT);
+    bump (shard.rx_syscalls);
+}
+
+void UdpServer::process_packets (Shard& shard) {
+    while (_running) {
+        UdpPacket* pkt{};
+        const auto pop = [&] { return shard.recv_queue.pop (pkt); };
+        if (!pop () && !shard.worker_waiter.wait (pop, IDLE_PARK_TIMEOUT))
+            continue;
+        bump (shard.rx_taken);
+
+        const auto action = handle_request (shard, *pkt);
+        if (auto* rsp = action.empty () ? nullptr : make_response (shard, *pkt, action)) {
+            if (shard.send_queue.push (rsp)) {
+                bump (shard.tx_queued);
+                shard.sender_waiter.notify ();
+            } else {
+                shard.response_pool.release (rsp);
+                bump (shard.tx_dropped);
+            }
         }
 
-        delete pkt;
+        shard.packet_pool.release (pkt);
+    }
+}
+
+std::string_view UdpServer::handle_request (Shard& shard, UdpPacket& pkt) {
+    pkt.trace.stamp (TraceStage::received, pkt.rx_ns);
+    pkt.trace.stamp (TraceStage::dequeued);
+
+    const auto imsi = Common::Imsi::from_bcd (pkt.bcd.data (), pkt.data_len);
+    if (!imsi.valid ()) {
+        bump (shard.rx_malformed);
+        return {};
     }
+    pkt.trace.stamp (TraceStage::decoded);
+
+    const bool blocked = _blacklist->is_in_blacklist (imsi);
+    pkt.trace.stamp (TraceStage::blacklist);
+    // While draining, only sessions that are still attached are refreshed; the protocol has no redirect answer,
+    // so a new attach is rejected rather than recreated behind the offload.
+    const bool draining = !blocked && _offload->draining ();
+    const bool refused  = draining && !_sessions->refresh_session (imsi);
+    const bool created  = !blocked && !draining && _sessions->create_session (imsi);
+    pkt.trace.stamp (TraceStage::session);
+
+    std::string_view action;
+    if (refused) {
+        action = "rejected";
+        bump (shard.refused);
+        _cdr->write (imsi, Common::CdrAction::rejected, _sessions->shard_of (imsi));
+    } else if (blocked) {
+        action = "rejected";
+        bump (shard.rejected);
+        _cdr->write (imsi, Common::CdrAction::rejected, _sessions->shard_of (imsi));
+    } else if (created) {
+        action = "created";
+        bump (shard.created);
+        _cdr->write (imsi, Common::CdrAction::created, _sessions->shard_of (imsi));
+    } else {
+        action = "exists";
+        bump (shard.existing);
+    }
+    pkt.trace.stamp (TraceStage::cdr);
+    return action;
+}
+
+UdpResponse* UdpServer::make_response (Shard& shard, const UdpPacket& pkt, const std::string_view action) {
+    auto* rsp = shard.response_pool.acquire ();
+    if (!rsp)
+        return nullptr;
+    rsp->set_response (action);
+    rsp->client_addr = pkt.client_addr;
+    rsp->addr_len    = pkt.addr_len;
+    rsp->rx_ns       = pkt.rx_ns;
+    rsp->trace       = pkt.trace;
+    rsp->trace.stamp (TraceStage::queued);
+    return rsp;
 }
 
-void UdpServer::send_responses () {
-    while (_running || !_send_queue.empty ()) {
+void UdpServer::send_responses (Shard& shard) {
+    if (_io_uring) {
+        try {
+            shard.tx_ring = std::make_unique<IoUring> (MAX_IO_BATCH, MAX_IO_BATCH * 2);
+        } catch (const std::system_error& ex) {
+            _logger->warn ("Shard {}: io_uring unavailable ({}), sending without it", shard.index, ex.what ());
+        }
+    }
+    if (shard.tx_ring || _batch_size > 1) {
+        send_batched (shard);
+        return;
+    }
+
+    while (_running || !shard.send_queue.empty ()) {
         UdpResponse* rsp{};
-        if (!_send_queue.pop (rsp)) {
-            std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        const auto pop = [&] { return shard.send_queue.pop (rsp); };
+        if (!pop () && !shard.sender_waiter.wait (pop, IDLE_PARK_TIMEOUT))
             continue;
-        }
-        sendto (_udp_fd, rsp->response.c_str (), rsp->response.size (), MSG_DONTWAIT,
+        bump (shard.tx_taken);
+        const ssize_t sent = sendto (shard.udp_fd, rsp->response.data (), rsp->response_len, MSG_DONTWAIT,
         reinterpret_cast<sockaddr*> (&rsp->client_addr), rsp->addr_len);
-        delete rsp;
+        bump (shard.tx_syscalls);
+        if (sent >= 0) {
+            bump (shard.tx_packets);
+            record_sent (shard, *rsp, steady_now_ns ());
+        }
+        shard.response_pool.release (rsp);
     }
 }
 
-void UdpServer::offload_sessions () {
-    _logger->info ("Starting graceful offload… rate={} sess/s", _graceful_shutdown_rate);
+void UdpServer::send_batched (Shard& shard) {
+    using namespace std::chrono;
+    auto& pending = shard.tx_pending;
+    auto deadline = steady_clock::now ();
 
-    while (true) {
-        std::size_t removed = 0;
-        for (std::size_t i = 0; i < _graceful_shutdown_rate; ++i) {
-            if (std::string victim; !_sessions->pop_one (victim))
-                break;
-            ++removed;
+    while (_running || !shard.send_queue.empty () || !pending.empty ()) {
+        UdpResponse* rsp{};
+        const auto pop = [&] { return shard.send_queue.pop (rsp); };
+        // An empty batch parks until work arrives; a partial one only until its flush deadline.
+        const microseconds park_for =
+        pending.empty () ? IDLE_PARK_TIMEOUT : duration_cast<microseconds> (deadline - steady_clock::now ());
+
+        if (pop () || (_running && park_for.count () > 0 && shard.sender_waiter.wait (pop, park_for))) {
+            if (pending.empty ())
+                deadline = steady_clock::now () + _flush_timeout;
+            bump (shard.tx_taken);
+            pending.push_back (rsp);
+            if (pending.size () < _batch_size)
+                continue;
         }
-        if (removed == 0)
+        if (!pending.empty ())
+            flush_responses (shard);
+    }
+}
+
+void UdpServer::flush_responses (Shard& shard) {
+    auto& pending = shard.tx_pending;
+    for (std::size_t i = 0; i < pending.size (); ++i) {
+        auto* rsp       = pending[i];
+        shard.tx_iov[i] = { rsp->response.data (), rsp->response_len };
+        auto& hdr       = shard.tx_msgs[i].msg_hdr;
+        hdr             = {};
+        hdr.msg_name    = &rsp->client_addr;
+        hdr.msg_namelen = rsp->addr_len;
+        hdr.msg_iov     = &shard.tx_iov[i];
+        hdr.msg_iovlen  = 1;
+    }
+
+    std::size_t from = 0;
+    if (shard.tx_ring && !send_uring (shard, *shard.tx_ring, from)) {
+        _logger->error ("Shard {}: io_uring send failed, sending with sendmmsg from now on", shard.index);
+        shard.tx_ring.reset ();
+    }
+
+    std::size_t sent = from;
+    while (sent < pending.size ()) {
+        const auto left = static_cast<unsigned> (pending.size () - sent);
+        const int n     = sendmmsg (shard.udp_fd, shard.tx_msgs.data () + sent, left, MSG_DONTWAIT);
+        bump (shard.tx_syscalls);
+        if (n <= 0)
             break;
-        std::this_thread::sleep_for (std::chrono::seconds (1));
+        sent += static_cast<std::size_t> (n);
     }
+    bump (shard.tx_packets, sent - from);
+
+    const int64_t tx_ns = steady_now_ns ();
+    for (std::size_t i = from; i < sent; ++i)
+        record_sent (shard, *pending[i], tx_ns);
+    for (auto* rsp : pending)
+        shard.response_pool.release (rsp);
+    pending.clear ();
+}
 
-    _logger->info ("Graceful offload finished, signalling main thread");
-    _running.store (false);
+bool UdpServer::send_uring (Shard& shard, IoUring& ring, std::size_t& taken) {
+    auto& pending      = shard.tx_pending;
+    std::size_t queued = 0;
+    for (; queued < pending.size (); ++queued)
+        if (!ring.sendmsg (shard.udp_fd, &shard.tx_msgs[queued].msg_hdr, MSG_DONTWAIT, queued))
+            break;
+
+    // Every request refers to a pending response, so all of them are reaped before the batch is released.
+    std::bitset<MAX_IO_BATCH> reaped;
+    std::size_t submitted = 0;
+    std::size_t done      = 0;
+    std::size_t sent      = 0;
+    bool ok               = true;
+    while (done < queued) {
+        const int rc = ring.submit_and_wait (static_cast<unsigned> (queued - done), IDLE_PARK_TIMEOUT);
+        bump (shard.tx_syscalls);
+        if (rc > 0)
+            submitted += static_cast<std::size_t> (rc);
+        const int64_t tx_ns = steady_now_ns ();
+        done += ring.drain ([&] (const IoUring::Completion& c) {
+            reaped.set (c.user_data);
+            if (c.res < 0)
+                return;
+            ++sent;
+            record_sent (shard, *pending[c.user_data], tx_ns);
+        });
+        if (rc < 0 && rc != -ETIME && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY) {
+            ok = false;
+            break;
+        }
+    }
+    bump (shard.tx_packets, sent);
+
+    taken = queued;
+    if (!ok) {
+        // The kernel consumes SQEs in order, so the first submitted ones are in flight and may still read their
+        // payload: those responses never go back to the pool. Their msghdrs were copied at submission.
+        for (std::size_t i = 0; i < submitted; ++i)
+            if (!reaped[i])
+                pending[i] = nullptr;
+        taken = submitted;
+    }
+    return ok;
 }
 
+void UdpServer::record_sent (Shard& shard, UdpResponse& rsp, const int64_t tx_ns) {
+    shard.latency.record (static_cast<uint64_t> (tx_ns - rsp.rx_ns));
+#ifdef PGW_ENABLE_TRACING
+    rsp.trace.stamp (TraceStage::sent, tx_ns);
+    for (std::size_t i = 1; i < TRACE_STAGES; ++i)
+        shard.stage_latency[i].record (static_cast<uint64_t> (rsp.trace.interval (static_cast<TraceStage> (i))));
+
+    const std::chrono::nanoseconds total (tx_ns - rsp.rx_ns);
+    if (_slow_trace_threshold.count () == 0 || total < _slow_trace_threshold)
+        return;
+    const auto now = std::chrono::steady_clock::now ();
+    if (now - shard.last_slow_log < SLOW_TRACE_LOG_INTERVAL)
+        return;
+    shard.last_slow_log = now;
+    std::string stages;
+    for (std::size_t i = 1; i < TRACE_STAGES; ++i) {
+        const auto stage = static_cast<TraceStage> (i);
+        fmt::format_to (std::back_inserter (stages), "{}{}={}us", i > 1 ? " " : "", trace_interval_name (stage),
+        rsp.trace.interval (stage) / 1000);
+    }
+    _logger->warn ("Slow packet on shard {}: {}us total ({}), response '{}'", shard.index, total.count () / 1000, stages,
+    rsp.view ());
+#endif
+}
 
 std::string UdpServer::bcd_to_imsi (const uint8_t* data, std::size_t len) {
+    // Odd-length IMSIs carry a 0xF filler in the last high nibble; skip it so a 15-digit IMSI stays in SSO storage.
+    const bool padded = len > 0 && (data[len - 1] >> 4) == 0x0F;
     std::string imsi;
-    imsi.reserve (len * 2);
+    imsi.reserve (len * 2 - (padded ? 1 : 0));
 
     for (std::size_t i = 0; i < len; ++i) {
         const uint8_t low  = data[i] & 0x0F;
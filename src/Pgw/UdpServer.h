@@ -2,14 +2,26 @@
 
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <thread>
+#include <vector>
 
+#include "AdaptiveWaiter.h"
+#include "IoUring.h"
+#include "OffloadScheduler.h"
 #include "SessionManager.h"
+#include "SlotPool.h"
+#include "SourceRateLimiter.h"
+#include "Tracing.h"
 #include "arpa/inet.h"
 #include "boost/lockfree/queue.hpp"
 #include "spdlog/spdlog.h"
+#include "sys/socket.h"
 
 #include "../Common/ConfigLoader.h"
+#include "../Common/Histogram.h"
+#include "../Common/Imsi.h"
 
 class SessionManager;
 class BlackListStorer;
@@ -20,25 +32,69 @@ namespace Pgw {
 constexpr std::size_t QUEUE_CAPACITY   = 4096;
 constexpr std::size_t UDP_BUFFER_SIZE  = 1024;
 constexpr std::size_t MAX_EPOLL_EVENTS = 16;
+constexpr std::size_t MAX_IO_BATCH     = 256;
+constexpr std::size_t RESPONSE_SIZE    = 16;
+// Upper bound of slots in flight per shard: a full queue, one I/O batch and the slot held by the worker.
+constexpr std::size_t POOL_CAPACITY = QUEUE_CAPACITY + MAX_IO_BATCH + 1;
+// Provided receive buffers per shard for the io_uring backend.
+constexpr unsigned URING_RX_BUFFERS = 1024;
+// Longest time an idle worker or sender stays parked before re-checking _running.
+constexpr std::chrono::milliseconds IDLE_PARK_TIMEOUT{ 10 };
+// Slow-packet dumps per shard are spaced at least this far apart.
+constexpr std::chrono::milliseconds SLOW_TRACE_LOG_INTERVAL{ 100 };
 
 struct UdpPacket {
     sockaddr_in client_addr{};
     std::array<uint8_t, UDP_BUFFER_SIZE> bcd{};
     socklen_t addr_len{};
     std::size_t data_len{};
+    int64_t rx_ns{}; // steady_clock at receive
+    [[no_unique_address]] PacketTrace trace;
 
     UdpPacket () : addr_len (sizeof (client_addr)) {
     }
 };
 
 struct UdpResponse {
-    std::string response;
+    std::array<char, RESPONSE_SIZE> response{};
+    std::size_t response_len{};
     sockaddr_in client_addr{};
     socklen_t addr_len{ sizeof (client_addr) };
+    int64_t rx_ns{}; // of the request
+    [[no_unique_address]] PacketTrace trace;
+
+    void set_response (const std::string_view text) {
+        response_len = text.copy (response.data (), response.size ());
+    }
+
+    std::string_view view () const {
+        return { response.data (), response_len };
+    }
+};
+
+struct IoStats {
+    uint64_t rx_syscalls{};
+    uint64_t rx_packets{};
+    uint64_t tx_syscalls{};
+    uint64_t tx_packets{};
+    uint64_t pool_exhausted{};
+    uint64_t rx_dropped{};
+    uint64_t tx_dropped{};
+    uint64_t rx_malformed{};
+    uint64_t shed_source_rate{}; // over the per-source token bucket
+    uint64_t shed_overload{};    // new attaches above the recv queue watermark
+    uint64_t created{};
+    uint64_t existing{};
+    uint64_t rejected{};
+    uint64_t refused{}; // new attaches turned away during a graceful offload
+    uint64_t recv_queue_depth{};
+    uint64_t send_queue_depth{};
 };
 
 using PacketQueue   = boost::lockfree::queue<UdpPacket*, boost::lockfree::capacity<QUEUE_CAPACITY> >;
 using ResponseQueue = boost::lockfree::queue<UdpResponse*, boost::lockfree::capacity<QUEUE_CAPACITY> >;
+using PacketPool    = SlotPool<UdpPacket, POOL_CAPACITY>;
+using ResponsePool  = SlotPool<UdpResponse, POOL_CAPACITY>;
 
 class UdpServer {
     public:
@@ -54,8 +110,13 @@ class UdpServer {
 
     void stop ();
 
+    // Starts draining the session table at graceful_shutdown_rate; the data plane keeps answering until it is empty.
     void initiate_graceful_shutdown ();
 
+    OffloadScheduler::Progress offload_progress () const {
+        return _offload->progress ();
+    }
+
     std::size_t session_count () const {
         return _sessions ? _sessions->session_count () : 0;
     }
@@ -66,41 +127,157 @@ class UdpServer {
 
     static std::string bcd_to_imsi (const uint8_t* data, std::size_t len);
 
+    std::size_t shard_count () const {
+        return _shards.size ();
+    }
+
+    IoStats io_stats () const;
+
+    // Shards whose receive loop runs on io_uring; less than shard_count () when some fell back to epoll.
+    std::size_t io_uring_shards () const;
+
+    // Receive-to-send time of answered requests, merged over shards.
+    Common::Histogram::Snapshot response_latency () const;
+
+    // Time spent in the interval closed by stage, merged over shards; empty unless built with PGW_ENABLE_TRACING.
+    Common::Histogram::Snapshot stage_latency (TraceStage stage) const;
+
+    // Prometheus text exposition of the data plane, session table and CDR writer.
+    void append_metrics (std::string& out) const;
+
     private:
-    void init_socket ();
+    struct Shard {
+        Shard (std::size_t idx, int cpu_id, SourceRateLimiter source_limiter)
+        : index (idx), cpu (cpu_id), limiter (std::move (source_limiter)) {
+        }
+
+        const std::size_t index;
+        const int cpu;
+
+        int udp_fd   = -1;
+        int epoll_fd = -1;
+
+        PacketQueue recv_queue;
+        ResponseQueue send_queue;
+        PacketPool packet_pool;
+        ResponsePool response_pool;
+        AdaptiveWaiter worker_waiter;
+        AdaptiveWaiter sender_waiter;
+
+        std::thread epoll_thread;
+        std::thread worker_thread;
+        std::thread sender_thread;
 
-    void event_loop ();
+        // Written by the epoll thread only.
+        alignas (64) std::atomic<uint64_t> rx_syscalls{ 0 };
+        std::atomic<uint64_t> rx_packets{ 0 };
+        std::atomic<uint64_t> rx_dropped{ 0 };
+        std::atomic<uint64_t> rx_queued{ 0 };
+        std::atomic<uint64_t> shed_source_rate{ 0 };
+        std::atomic<uint64_t> shed_overload{ 0 };
+        std::atomic<bool> uring_rx{ false };
+        SourceRateLimiter limiter;
+        std::vector<UdpPacket*> rx_slots;
+        std::vector<mmsghdr> rx_msgs;
+        std::vector<iovec> rx_iov;
 
-    void process_packets ();
+        // Written by the worker thread only.
+        alignas (64) std::atomic<uint64_t> tx_dropped{ 0 };
+        std::atomic<uint64_t> rx_malformed{ 0 };
+        std::atomic<uint64_t> rx_taken{ 0 };
+        std::atomic<uint64_t> tx_queued{ 0 };
+        std::atomic<uint64_t> created{ 0 };
+        std::atomic<uint64_t> existing{ 0 };
+        std::atomic<uint64_t> rejected{ 0 };
+        std::atomic<uint64_t> refused{ 0 };
 
-    void send_responses ();
+        // Written by the sender thread only.
+        alignas (64) std::atomic<uint64_t> tx_syscalls{ 0 };
+        std::atomic<uint64_t> tx_packets{ 0 };
+        std::atomic<uint64_t> tx_taken{ 0 };
+        Common::Histogram latency;
+#ifdef PGW_ENABLE_TRACING
+        std::array<Common::Histogram, TRACE_STAGES> stage_latency;
+        std::chrono::steady_clock::time_point last_slow_log;
+#endif
+        std::vector<UdpResponse*> tx_pending;
+        std::vector<mmsghdr> tx_msgs;
+        std::vector<iovec> tx_iov;
+        std::unique_ptr<IoUring> tx_ring;
+    };
 
-    void offload_sessions ();
+    void init_socket (Shard& shard) const;
+
+    void event_loop (Shard& shard);
+
+    // io_uring receive side: one multishot recvmsg into provided buffers; falls back to event_loop when the kernel
+    // cannot do it.
+    void uring_event_loop (Shard& shard);
+
+    // udp_pipeline run_to_completion: the shard's only thread receives a batch, answers it inline and sends the
+    // responses on the same socket; no queues or thread hand-offs.
+    void serve_batch (Shard& shard);
+
+    void receive_one (Shard& shard);
+
+    void receive_batch (Shard& shard);
+
+    // Gives every rx slot up to _batch_size a packet and points its recvmmsg header at it; returns the slots ready.
+    std::size_t arm_rx_slots (Shard& shard);
+
+    void discard_datagram (Shard& shard);
+
+    // Admission control on the epoll thread, ahead of the recv queue: the per-source rate limit, then, with queued
+    // packets already waiting above the watermark, only refreshes of known sessions get in.
+    bool admit (Shard& shard, const UdpPacket& pkt, uint64_t queued);
+
+    void process_packets (Shard& shard);
+
+    // Blacklist, session and CDR work for one request; the answer, or empty for a malformed IMSI.
+    std::string_view handle_request (Shard& shard, UdpPacket& pkt);
+
+    // Nothing when the response pool is exhausted.
+    UdpResponse* make_response (Shard& shard, const UdpPacket& pkt, std::string_view action);
+
+    void send_responses (Shard& shard);
+
+    void send_batched (Shard& shard);
+
+    // Through shard.tx_ring when there is one, dropping it after a hard ring error; otherwise sendmmsg.
+    void flush_responses (Shard& shard);
+
+    // One sendmsg SQE per pending response, submitted and reaped with a single io_uring_enter when all complete
+    // inline. Sets taken to the pending responses, from the front, the ring is done with; false on a hard ring error,
+    // after which the rest has to go through sendmmsg.
+    bool send_uring (Shard& shard, IoUring& ring, std::size_t& taken);
+
+    // Sender side bookkeeping for one response handed to the kernel at tx_ns.
+    void record_sent (Shard& shard, UdpResponse& rsp, int64_t tx_ns);
+
+    void pin_thread (std::thread& thread, const Shard& shard) const;
 
 
     const std::string _bind_ip;
     const uint16_t _bind_port;
-    const std::size_t _graceful_shutdown_rate;
+    const std::size_t _batch_size;
+    const bool _io_uring;
+    const bool _run_to_completion;
+    const std::chrono::microseconds _flush_timeout;
+    const std::chrono::milliseconds _expiry_tick;
+    const std::chrono::nanoseconds _slow_trace_threshold;
+    const std::size_t _queue_watermark;
 
-    int _udp_fd   = -1;
-    int _epoll_fd = -1;
+    std::vector<std::unique_ptr<Shard> > _shards;
 
     std::shared_ptr<ControlPlaneServer> _http;
     std::shared_ptr<SessionManager> _sessions;
     std::shared_ptr<BlackListStorer> _blacklist;
     std::shared_ptr<CdrWriter> _cdr;
+    std::unique_ptr<OffloadScheduler> _offload;
 
     std::atomic<bool> _running{ false };
-    std::atomic<bool> _graceful{ false };
-
-    PacketQueue _recv_queue;
-    ResponseQueue _send_queue;
 
-    std::thread _epoll_thread;
-    std::thread _worker_thread;
-    std::thread _sender_thread;
     std::thread _timeout_thread;
-    std::thread _offload_thread;
 
     std::shared_ptr<spdlog::logger> _logger;
 };
@@ -8,6 +8,7 @@
 #include "Pgw/CdrWriter.h"
 #include "Pgw/ControlPlaneServer.h"
 #include "Pgw/SessionManager.h"
+#include "Pgw/SessionStore.h"
 #include "Pgw/UdpServer.h"
 
 static std::atomic g_stop{ false };
@@ -24,14 +25,35 @@ int main () {
         log->info ("=== pgw_server starting ===");
         auto cdr_writer = std::make_shared<CdrWriter> (settings, log);
         auto blacklist  = std::make_shared<BlackListStorer> (1'000'003, log);
-        auto sessions   = std::make_shared<SessionManager> (settings.session_timeout_sec, *cdr_writer, log);
+        auto sessions   =
+        std::make_shared<SessionManager> (settings.session_timeout_sec, *cdr_writer, log, settings.session_shards);
         auto udp_srv    = std::make_shared<Pgw::UdpServer> (settings, nullptr, sessions, blacklist, cdr_writer);
-        auto stop_cb    = [udp_srv] () {
+        std::unique_ptr<SessionStore> session_store;
+        auto stop_cb = [udp_srv, &session_store] () {
+            // The offload empties the table, so the final snapshot must come first for a warm restart to restore it.
+            if (session_store)
+                session_store->stop ();
             udp_srv->initiate_graceful_shutdown ();
             g_stop.store (true);
         };
         const auto http = std::make_shared<ControlPlaneServer> (settings, *sessions, stop_cb, log);
         udp_srv->set_http_server (http);
+        http->set_blacklist (blacklist);
+        http->set_metrics_source ([udp = std::weak_ptr (udp_srv)] (std::string& out) {
+            if (const auto srv = udp.lock ())
+                srv->append_metrics (out);
+        });
+        http->set_offload_source ([udp = std::weak_ptr (udp_srv)] {
+            const auto srv = udp.lock ();
+            return srv ? srv->offload_progress () : Pgw::OffloadScheduler::Progress{};
+        });
+        if (!settings.session_snapshot_file.empty ()) {
+            session_store = std::make_unique<SessionStore> (settings, *sessions, log);
+            session_store->restore ();
+            session_store->start ();
+        }
+        if (!settings.blacklist_file.empty ())
+            blacklist->watch (settings.blacklist_file, std::chrono::milliseconds (settings.blacklist_poll_interval_ms));
         http->start ();
         udp_srv->start ();
         std::signal (SIGINT, on_signal);
@@ -41,8 +63,11 @@ int main () {
             std::this_thread::sleep_for (std::chrono::milliseconds (200));
         log->info ("Signal received → graceful shutdown");
         stop_cb ();
+        // Waits for the offload to drain the session table; /offload stays available meanwhile.
+        udp_srv->stop ();
         http->stop ();
         udp_srv.reset ();
+        session_store.reset ();
 
         log->info ("=== pgw_server stopped ===");
         return 0;
@@ -1,27 +1,76 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <gtest/gtest.h>
+#include <map>
+#include <new>
+#include <poll.h>
+#include <set>
 #include <string>
 #include <thread>
 #include <unordered_set>
 #include <vector>
 
+#include "../src/Client/LoadGenerator.h"
 #include "../src/Client/UdpClient.h"
+#include "../src/Common/CdrFormat.h"
 #include "../src/Common/ConfigLoader.h"
+#include "../src/Common/Histogram.h"
+#include "../src/Common/Imsi.h"
+#include "../src/Common/Timestamp.h"
+#include "../src/Pgw/AdaptiveWaiter.h"
 #include "../src/Pgw/BlackListStorer.h"
 #include "../src/Pgw/CdrWriter.h"
+#include "../src/Pgw/ControlPlaneServer.h"
+#include "../src/Pgw/OffloadScheduler.h"
 #include "../src/Pgw/SessionManager.h"
+#include "../src/Pgw/SessionStore.h"
+#include "../src/Pgw/SlotPool.h"
+#include "../src/Pgw/SourceRateLimiter.h"
 #include "../src/Pgw/UdpServer.h"
 #include "nlohmann/json.hpp"
 #include "spdlog/sinks/null_sink.h"
 
+#ifdef PGW_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+
+static std::atomic<std::size_t> g_heap_allocations{ 0 };
+
+// Counting replacement of the global allocator. GCC pairs the inlined free with new-expressions and reports a
+// mismatch, which does not apply to a replacement built on malloc.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new (const std::size_t size) {
+    g_heap_allocations.fetch_add (1, std::memory_order_relaxed);
+    if (void* p = std::malloc (size ? size : 1))
+        return p;
+    throw std::bad_alloc ();
+}
+
+void operator delete (void* p) noexcept {
+    std::free (p);
+}
+
+void operator delete (void* p, std::size_t) noexcept {
+    std::free (p);
+}
+#pragma GCC diagnostic pop
 
 static std::shared_ptr<spdlog::logger> make_null_logger (const std::string& name = "null") {
     return std::make_shared<spdlog::logger> (name, std::make_shared<spdlog::sinks::null_sink_mt> ());
 }
 
+static Common::Imsi make_imsi (const std::string_view digits) {
+    return Common::Imsi::from_string (digits);
+}
+
 static std::vector<uint8_t> encode_imsi_bcd (std::string imsi) {
     if (imsi.size () % 2 != 0)
         imsi.push_back ('F');
@@ -38,6 +87,94 @@ static std::filesystem::path temp_dir () {
     return std::filesystem::temp_directory_path ();
 }
 
+static void ensure_project_dir () {
+    setenv ("PROJECT_DIR", temp_dir ().c_str (), 0);
+    std::filesystem::create_directories (std::filesystem::path (std::getenv ("PROJECT_DIR")) / "logs");
+}
+
+static Common::ServerSettings loopback_settings (const uint16_t port) {
+    ensure_project_dir ();
+    Common::ServerSettings s{};
+    s.udp_ip                 = "127.0.0.1";
+    s.udp_port               = port;
+    s.session_timeout_sec    = 60;
+    s.graceful_shutdown_rate = 100;
+    s.cdr_file               = (temp_dir () / ("cdr_udp_" + std::to_string (port) + ".log")).string ();
+    s.log_file               = "udp_test_" + std::to_string (port) + ".log";
+    return s;
+}
+
+// A loopback UdpServer over its own CDR writer, session table and blacklist, stopped after the test together with the
+// sockets and clients the test opened.
+class UdpServerFixture : public ::testing::Test {
+    protected:
+    void TearDown () override {
+        if (_server)
+            _server->stop ();
+        _clients.clear ();
+        for (const int fd : _sockets)
+            close (fd);
+    }
+
+    // Builds the components for s; a test may fill _sessions before start_server ().
+    void prepare (const Common::ServerSettings& s) {
+        _settings  = s;
+        _cdr       = std::make_shared<CdrWriter> (s, _logger);
+        _sessions  = std::make_shared<SessionManager> (s.session_timeout_sec, *_cdr, _logger);
+        _blacklist = std::make_shared<BlackListStorer> (128, _logger);
+    }
+
+    Pgw::UdpServer& start_server () {
+        _server = std::make_unique<Pgw::UdpServer> (_settings, nullptr, _sessions, _blacklist, _cdr);
+        _server->start ();
+        return *_server;
+    }
+
+    Pgw::UdpServer& start_server (const Common::ServerSettings& s) {
+        prepare (s);
+        return start_server ();
+    }
+
+    // Blocking UDP socket connected to the server.
+    int connect_socket (const int rcvbuf = 0) {
+        const int fd = socket (AF_INET, SOCK_DGRAM, 0);
+        _sockets.push_back (fd);
+        if (rcvbuf > 0)
+            setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port   = htons (_settings.udp_port);
+        inet_aton (_settings.udp_ip.c_str (), &addr.sin_addr);
+        EXPECT_EQ (connect (fd, reinterpret_cast<sockaddr*> (&addr), sizeof addr), 0);
+        return fd;
+    }
+
+    Common::ClientSettings client_settings (const std::string& log_file = "udp_test_client.log") const {
+        Common::ClientSettings cs{};
+        cs.server_ip   = _settings.udp_ip;
+        cs.server_port = _settings.udp_port;
+        cs.log_file    = log_file;
+        return cs;
+    }
+
+    client::UdpClient& connect_client (const std::string& log_file) {
+        auto& cl = *_clients.emplace_back (std::make_unique<client::UdpClient> (client_settings (log_file)));
+        cl.init_sockets ();
+        return cl;
+    }
+
+    const std::shared_ptr<spdlog::logger> _logger = make_null_logger ();
+    Common::ServerSettings _settings;
+    std::shared_ptr<CdrWriter> _cdr;
+    std::shared_ptr<SessionManager> _sessions;
+    std::shared_ptr<BlackListStorer> _blacklist;
+    std::unique_ptr<Pgw::UdpServer> _server;
+    std::vector<std::unique_ptr<client::UdpClient> > _clients;
+    std::vector<int> _sockets;
+};
+
+class LoadGeneratorFixture : public UdpServerFixture {};
+
 TEST (UdpClientTest, GenerateDefaultLength15) {
     const std::string imsi = client::UdpClient::generate_imsi ();
     EXPECT_EQ (imsi.size (), 15);
@@ -63,14 +200,114 @@ TEST (BlackListStorerTest, LookupPositive) {
     BlackListStorer bl (128, logger);
     const std::unordered_set<std::string> s{ "250990000000001" };
     bl.store (s);
-    EXPECT_TRUE (bl.is_in_blacklist ("250990000000001"));
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("250990000000001")));
 }
 
 TEST (BlackListStorerTest, LookupNegative) {
     auto logger = make_null_logger ();
     BlackListStorer bl (128, logger);
     bl.store ({ "250990000000001" });
-    EXPECT_FALSE (bl.is_in_blacklist ("250990000000002"));
+    EXPECT_FALSE (bl.is_in_blacklist (make_imsi ("250990000000002")));
+}
+
+TEST (BlackListStorerTest, BlockedBloomHasNoFalseNegatives) {
+    BlackListStorer bl (1024, make_null_logger ());
+    std::unordered_set<std::string> entries;
+    for (std::size_t i = 0; i < 20'000; ++i)
+        entries.insert ("25099" + std::to_string (3'000'000'000 + i * 7));
+    bl.store (entries);
+
+    EXPECT_TRUE (std::has_single_bit (bl.bloom_bytes ()));
+    EXPECT_GE (bl.bloom_bytes () * 8, entries.size () * 16);
+    EXPECT_LT (bl.bloom_fpr (), 0.005);
+    for (const auto& e : entries)
+        ASSERT_TRUE (bl.is_in_blacklist (make_imsi (e))) << e;
+    for (std::size_t i = 0; i < 1000; ++i)
+        EXPECT_FALSE (bl.is_in_blacklist (make_imsi ("25099" + std::to_string (3'000'000'001 + i * 7))));
+}
+
+static bool wait_for (const std::function<bool ()>& condition, const std::chrono::milliseconds limit) {
+    const auto deadline = std::chrono::steady_clock::now () + limit;
+    while (!condition ()) {
+        if (std::chrono::steady_clock::now () > deadline)
+            return false;
+        std::this_thread::sleep_for (std::chrono::milliseconds (5));
+    }
+    return true;
+}
+
+TEST (BlackListStorerTest, WatchedFileReloadsWithoutLosingConfiguredEntries) {
+    const auto file = temp_dir () / "blacklist_watch.txt";
+    std::ofstream (file) << "# operator test ranges\n250990000000100\n";
+    const auto configured = make_imsi ("250990000000001"), listed = make_imsi ("250990000000100"),
+               added      = make_imsi ("250990000000200");
+
+    BlackListStorer bl (1024, make_null_logger ());
+    bl.store ({ "250990000000001" });
+    ASSERT_TRUE (bl.watch (file, std::chrono::milliseconds (10)));
+    EXPECT_TRUE (bl.is_in_blacklist (configured));
+    EXPECT_TRUE (bl.is_in_blacklist (listed));
+    EXPECT_FALSE (bl.is_in_blacklist (added));
+
+    std::atomic<bool> done{ false };
+    std::atomic<std::size_t> misses{ 0 };
+    std::thread reader ([&] {
+        while (!done)
+            if (!bl.is_in_blacklist (configured))
+                misses.fetch_add (1);
+    });
+    for (std::size_t i = 0; i < 20; ++i)
+        EXPECT_TRUE (bl.reload ());
+    std::ofstream (file) << "250990000000200 # added\nnot-an-imsi\n";
+    EXPECT_TRUE (wait_for ([&] { return bl.is_in_blacklist (added); }, std::chrono::seconds (2)));
+    done = true;
+    reader.join ();
+
+    EXPECT_EQ (misses.load (), 0u);
+    EXPECT_FALSE (bl.is_in_blacklist (listed));
+    EXPECT_EQ (bl.size (), 2u);
+}
+
+TEST (BlackListStorerTest, PrefixRulesBlockWholeNetworks) {
+    BlackListStorer bl (1024, make_null_logger ());
+    bl.store ({ "25099*", "2500*", "250010000000001", "25*x" });
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("250990000000000")));
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("250999999999999")));
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("250012345678901")));
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("250010000000001")));
+    EXPECT_FALSE (bl.is_in_blacklist (make_imsi ("250980000000000")));
+    EXPECT_FALSE (bl.is_in_blacklist (make_imsi ("250100000000000")));
+    EXPECT_EQ (bl.range_count (), 2u);
+    EXPECT_EQ (bl.size (), 1u);
+}
+
+TEST (BlackListStorerTest, MappedFileMatchesSortedSearch) {
+    std::vector<uint64_t> imsis;
+    for (uint64_t i = 0; i < 50'000; ++i)
+        imsis.push_back (make_imsi (std::to_string (250010000000000 + i * 7)).raw ());
+    const auto file = temp_dir () / "blacklist.bin";
+    ASSERT_TRUE (Common::write_blacklist_file (file.c_str (), imsis, { *Common::parse_imsi_prefix ("31026*") }));
+
+    BlackListStorer bl (1024, make_null_logger ());
+    bl.store ({ "250990000000001" });
+    ASSERT_TRUE (bl.watch (file, std::chrono::milliseconds (0)));
+    EXPECT_EQ (bl.size (), imsis.size () + 1);
+    EXPECT_EQ (bl.range_count (), 1u);
+    for (uint64_t i = 0; i < 50'000 * 7; ++i) {
+        const auto imsi = make_imsi (std::to_string (250010000000000 + i));
+        ASSERT_EQ (bl.is_in_blacklist (imsi), i % 7 == 0) << imsi;
+    }
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("250990000000001")));
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("310260000000042")));
+    EXPECT_FALSE (bl.is_in_blacklist (make_imsi ("310270000000042")));
+
+    // Replaced the way a publisher must do it: a truncated copy renamed over the file, never a rewrite of the mapping.
+    const auto broken = temp_dir () / "blacklist.bin.tmp";
+    std::filesystem::copy_file (file, broken, std::filesystem::copy_options::overwrite_existing);
+    std::filesystem::resize_file (broken, std::filesystem::file_size (broken) - 8);
+    std::filesystem::rename (broken, file);
+    EXPECT_FALSE (bl.reload ());
+    EXPECT_TRUE (bl.is_in_blacklist (make_imsi ("250010000000007")));
 }
 
 class SessionManagerFixture : public ::testing::Test {
@@ -80,13 +317,13 @@ class SessionManagerFixture : public ::testing::Test {
         s.cdr_file = (temp_dir () / "cdr_test.log").string ();
         _writer    = std::make_unique<CdrWriter> (s, make_null_logger ());
         _manager   = std::make_unique<SessionManager> (0 /*timeout*/, *_writer, make_null_logger ());
-        _imsi1     = "250991234567890";
-        _imsi2     = "250991234567891";
+        _imsi1     = make_imsi ("250991234567890");
+        _imsi2     = make_imsi ("250991234567891");
     }
 
     std::unique_ptr<CdrWriter> _writer;
     std::unique_ptr<SessionManager> _manager;
-    std::string _imsi1, _imsi2;
+    Common::Imsi _imsi1, _imsi2;
 };
 
 TEST_F (SessionManagerFixture, CreateSessionReturnsTrueFirstTime) {
@@ -102,7 +339,7 @@ TEST_F (SessionManagerFixture, CreateSessionReturnsFalseOnDuplicate) {
 
 TEST_F (SessionManagerFixture, RemoveSessionPresent) {
     _manager->create_session (_imsi1);
-    EXPECT_TRUE (_manager->remove_session (_imsi1, "manual"));
+    EXPECT_TRUE (_manager->remove_session (_imsi1));
     EXPECT_EQ (_manager->session_count (), 0u);
 }
 
@@ -115,18 +352,380 @@ TEST_F (SessionManagerFixture, RemoveTimeoutImmediately) {
 TEST_F (SessionManagerFixture, PopOneRemovesAndReturns) {
     _manager->create_session (_imsi1);
     _manager->create_session (_imsi2);
-    std::string victim;
+    Common::Imsi victim;
     EXPECT_TRUE (_manager->pop_one (victim));
     EXPECT_TRUE (victim == _imsi1 || victim == _imsi2);
     EXPECT_EQ (_manager->session_count (), 1u);
 }
 
+TEST_F (SessionManagerFixture, PopOneDrainsEveryShard) {
+    constexpr std::size_t total = 200;
+    for (std::size_t i = 0; i < total; ++i)
+        _manager->create_session (make_imsi ("25099100000" + std::to_string (1000 + i)));
+    EXPECT_EQ (_manager->session_count (), total);
+
+    std::size_t popped = 0;
+    for (Common::Imsi victim; _manager->pop_one (victim);)
+        ++popped;
+    EXPECT_EQ (popped, total);
+    EXPECT_EQ (_manager->session_count (), 0u);
+}
+
+TEST_F (SessionManagerFixture, OffloadSchedulerPacesRemovals) {
+    constexpr std::size_t total = 200;
+    for (std::size_t i = 0; i < total; ++i)
+        _manager->create_session (make_imsi ("25099100000" + std::to_string (1000 + i)));
+    _manager->refresh_session (make_imsi ("250991000001000"));
+    EXPECT_FALSE (_manager->refresh_session (make_imsi ("250991000009999")));
+
+    Pgw::OffloadScheduler offload (*_manager, 2000, std::chrono::microseconds (500), make_null_logger ());
+    EXPECT_EQ (ControlPlaneServer::offload_status (offload.progress ()).find ("\"state\":\"idle\""), 1u);
+    std::atomic<bool> done{ false };
+    const auto started = std::chrono::steady_clock::now ();
+    offload.start ([&] { done = true; });
+    offload.start ({});
+
+    // 2000/s spreads 200 sessions over ~100 ms instead of removing them at once.
+    std::this_thread::sleep_for (std::chrono::milliseconds (30));
+    const auto midway = offload.progress ();
+    EXPECT_EQ (midway.state, Pgw::OffloadScheduler::State::draining);
+    EXPECT_GT (midway.removed, 0u);
+    EXPECT_LT (midway.removed, total);
+    EXPECT_EQ (midway.removed + midway.remaining, total);
+    EXPECT_GT (midway.eta_sec, 0.0);
+    EXPECT_TRUE (_manager->has_session (make_imsi ("250991000001000"))); // refreshed last, so offloaded last
+
+    offload.wait ();
+    EXPECT_GE (std::chrono::steady_clock::now () - started, std::chrono::milliseconds (90));
+    EXPECT_TRUE (done);
+    EXPECT_EQ (_manager->session_count (), 0u);
+    const auto status = ControlPlaneServer::offload_status (offload.progress ());
+    EXPECT_NE (status.find ("\"state\":\"done\",\"total\":200,\"removed\":200,\"remaining\":0"), std::string::npos)
+    << status;
+}
+
+TEST_F (SessionManagerFixture, OffloadSchedulerRateZeroRemovesNothing) {
+    _manager->create_session (_imsi1);
+    _manager->create_session (_imsi2);
+
+    Pgw::OffloadScheduler offload (*_manager, 0, std::chrono::microseconds (500), make_null_logger ());
+    std::atomic<bool> done{ false };
+    offload.start ([&] { done = true; });
+    offload.wait ();
+    EXPECT_TRUE (done);
+    EXPECT_EQ (_manager->session_count (), 2u);
+    const auto progress = offload.progress ();
+    EXPECT_EQ (progress.state, Pgw::OffloadScheduler::State::done);
+    EXPECT_EQ (progress.removed, 0u);
+    EXPECT_EQ (progress.remaining, 2u);
+}
+
+TEST (SessionManagerTest, ConcurrentCreateAndLookup) {
+    Common::ServerSettings s{};
+    s.cdr_file = (temp_dir () / "cdr_concurrent_test.log").string ();
+    CdrWriter writer (s, make_null_logger ());
+    SessionManager manager (60, writer, make_null_logger (), 16);
+    EXPECT_EQ (manager.shard_count (), 16u);
+
+    constexpr std::size_t threads = 4, per_thread = 500;
+    std::vector<std::thread> workers;
+    std::atomic<std::size_t> created{ 0 };
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back ([&, t] {
+            for (std::size_t i = 0; i < per_thread; ++i) {
+                const auto imsi = make_imsi ("2509920000" + std::to_string (10000 + t * per_thread + i));
+                if (manager.create_session (imsi))
+                    created.fetch_add (1);
+                EXPECT_TRUE (manager.has_session (imsi));
+                EXPECT_FALSE (manager.create_session (imsi));
+            }
+        });
+    }
+    for (auto& w : workers)
+        w.join ();
+
+    EXPECT_EQ (created.load (), threads * per_thread);
+    EXPECT_EQ (manager.session_count (), threads * per_thread);
+}
+
+TEST (SessionManagerTest, LockFreeLookupSurvivesChurn) {
+    Common::ServerSettings s{};
+    s.cdr_file = (temp_dir () / "cdr_churn_test.log").string ();
+    CdrWriter writer (s, make_null_logger ());
+    SessionManager manager (60, writer, make_null_logger (), 2);
+    std::vector<Common::Imsi> stable;
+    for (std::size_t i = 0; i < 100; ++i) {
+        stable.push_back (make_imsi ("2509930000" + std::to_string (10000 + i)));
+        manager.create_session (stable.back ());
+    }
+
+    std::atomic<bool> done{ false };
+    std::atomic<std::size_t> misses{ 0 };
+    std::vector<std::thread> readers;
+    for (std::size_t t = 0; t < 3; ++t) {
+        readers.emplace_back ([&] {
+            while (!done)
+                for (const auto& imsi : stable)
+                    if (!manager.has_session (imsi))
+                        misses.fetch_add (1);
+        });
+    }
+    // Grows and shrinks the tables repeatedly, so readers race with rebuilds and tombstone reuse.
+    for (std::size_t round = 0; round < 20; ++round) {
+        std::vector<Common::Imsi> churn;
+        for (std::size_t i = 0; i < 2000; ++i) {
+            churn.push_back (make_imsi ("2509940000" + std::to_string (10000 + round * 2000 + i)));
+            manager.create_session (churn.back ());
+        }
+        for (const auto& imsi : churn)
+            manager.remove_session (imsi);
+        EXPECT_FALSE (manager.has_session (churn.front ()));
+    }
+    done = true;
+    for (auto& r : readers)
+        r.join ();
+
+    EXPECT_EQ (misses.load (), 0u);
+    EXPECT_EQ (manager.session_count (), stable.size ());
+}
+
+TEST (SessionManagerTest, RetiredPresenceTablesFreedAfterReader) {
+    Common::ServerSettings s{};
+    s.cdr_file = (temp_dir () / "cdr_retired_test.log").string ();
+    CdrWriter writer (s, make_null_logger ());
+    SessionManager manager (60, writer, make_null_logger (), 1);
+    std::size_t next = 0;
+    auto create       = [&] (std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i)
+            manager.create_session (make_imsi ("2509950000" + std::to_string (10000 + next++)));
+    };
+
+    {
+        const SessionManager::PresenceReader reader (manager, 0);
+        create (1000); // several rebuilds, none of whose old tables may be freed yet
+        EXPECT_GT (manager.retired_presence_tables (0), 1u);
+    }
+    // One write frees the tables retired before the epoch moved on and moves it again, the next frees the rest.
+    create (2);
+    EXPECT_EQ (manager.retired_presence_tables (0), 0u);
+    EXPECT_EQ (manager.session_count (), 1002u);
+}
+
+TEST (ControlPlaneTest, BulkCheckAnswersInRequestOrder) {
+    Common::ServerSettings s{};
+    s.cdr_file = (temp_dir () / "cdr_bulk_test.log").string ();
+    CdrWriter writer (s, make_null_logger ());
+    SessionManager manager (60, writer, make_null_logger (), 4);
+    std::string body;
+    for (std::size_t i = 0; i < 10; ++i) {
+        const auto digits = "2509950000" + std::to_string (10000 + i);
+        if (i % 3 == 0)
+            manager.create_session (make_imsi (digits));
+        body += digits + (i % 2 ? ",\n" : " ");
+    }
+
+    const auto json_body = R"(["250995000010000", "25x", "250995000010001"])";
+    EXPECT_EQ (ControlPlaneServer::check_subscribers (manager, json_body, false), "[true,null,false]");
+    EXPECT_EQ (ControlPlaneServer::check_subscribers (manager, "", false), "[]");
+    // Active: 0, 3, 6, 9 -> 0b01001001, 0b10.
+    EXPECT_EQ (ControlPlaneServer::check_subscribers (manager, body, true), std::string ("\x49\x02", 2));
+
+    std::string too_many;
+    for (std::size_t i = 0; i <= ControlPlaneServer::MAX_BULK_IMSIS; ++i)
+        too_many += "1 ";
+    EXPECT_FALSE (ControlPlaneServer::check_subscribers (manager, too_many, false));
+}
+
+TEST (ControlPlaneTest, SessionDumpPagesCoverEveryShardOnce) {
+    Common::ServerSettings s{};
+    s.cdr_file = (temp_dir () / "cdr_dump_test.log").string ();
+    CdrWriter writer (s, make_null_logger ());
+    SessionManager manager (60, writer, make_null_logger (), 16);
+    std::set<std::string> expected;
+    for (std::size_t i = 0; i < 1000; ++i) {
+        expected.insert ("2509960000" + std::to_string (10000 + i));
+        manager.create_session (make_imsi (*expected.rbegin ()));
+    }
+    for (std::size_t i = 0; i < 200; ++i)
+        manager.remove_session (make_imsi ("2509960000" + std::to_string (10000 + i * 5)));
+    for (std::size_t i = 0; i < 200; ++i)
+        expected.erase ("2509960000" + std::to_string (10000 + i * 5));
+
+    // 800 sessions over 16 shards: pages of 37 end mid-shard and never line up with shard boundaries.
+    constexpr std::size_t LIMIT = 37;
+    std::multiset<std::string> listed;
+    std::size_t pages = 0;
+    for (nlohmann::json cursor = "0"; !cursor.is_null (); ++pages) {
+        const auto parsed = ControlPlaneServer::parse_cursor (cursor.get<std::string> ());
+        ASSERT_TRUE (parsed.has_value ()) << cursor;
+        const auto page = nlohmann::json::parse (ControlPlaneServer::dump_sessions (manager, *parsed, LIMIT));
+        EXPECT_LE (page["sessions"].size (), LIMIT);
+        for (const auto& imsi : page["sessions"])
+            listed.insert (imsi.get<std::string> ());
+        cursor = page["next_cursor"];
+    }
+    EXPECT_EQ (pages, (expected.size () + LIMIT - 1) / LIMIT);
+    EXPECT_EQ (listed, (std::multiset<std::string> (expected.begin (), expected.end ())));
+
+    EXPECT_FALSE (ControlPlaneServer::parse_cursor ("").has_value ());
+    EXPECT_FALSE (ControlPlaneServer::parse_cursor ("3:").has_value ());
+    EXPECT_FALSE (ControlPlaneServer::parse_cursor ("3-250996000010000").has_value ());
+}
+
+TEST (SessionManagerTest, RefreshPostponesExpiry) {
+    Common::ServerSettings s{};
+    s.cdr_file = (temp_dir () / "cdr_expiry_test.log").string ();
+    CdrWriter writer (s, make_null_logger ());
+    SessionManager manager (1, writer, make_null_logger (), 1);
+    const auto stale = make_imsi ("250991234567890"), refreshed = make_imsi ("250991234567891");
+
+    manager.create_session (stale);
+    manager.create_session (refreshed);
+    std::this_thread::sleep_for (std::chrono::milliseconds (600));
+    EXPECT_FALSE (manager.create_session (refreshed));
+    std::this_thread::sleep_for (std::chrono::milliseconds (600));
+
+    manager.remove_timeout ();
+    EXPECT_FALSE (manager.has_session (stale));
+    EXPECT_TRUE (manager.has_session (refreshed));
+    EXPECT_EQ (manager.session_count (), 1u);
+}
+
+TEST (SessionStoreTest, SnapshotAndJournalSurviveRestart) {
+    Common::ServerSettings s{};
+    s.session_timeout_sec               = 60;
+    s.cdr_file                          = (temp_dir () / "cdr_store_test.log").string ();
+    s.session_snapshot_file             = (temp_dir () / "sessions.snap").string ();
+    s.session_snapshot_interval_sec     = 0;
+    s.session_journal                   = true;
+    s.session_journal_flush_interval_ms = 10;
+    s.session_journal_fsync             = true;
+    auto crashed                  = s;
+    crashed.session_snapshot_file = (temp_dir () / "sessions_crashed.snap").string ();
+    for (const auto& f : { s.session_snapshot_file, crashed.session_snapshot_file }) {
+        std::filesystem::remove (f);
+        std::filesystem::remove (f + ".journal");
+    }
+    const auto imsi = [] (const int i) {
+        return Common::Imsi::from_string ("25099" + std::to_string (1'000'000'000 + i));
+    };
+
+    const auto logger = make_null_logger ();
+    CdrWriter writer (s, logger);
+    {
+        SessionManager sessions (s.session_timeout_sec, writer, logger);
+        SessionStore store (s, sessions, logger);
+        EXPECT_EQ (store.restore (), 0u);
+        for (int i = 0; i < 1000; ++i)
+            sessions.create_session (imsi (i));
+        store.start ();
+        EXPECT_EQ (store.generation (), 1u);
+
+        // After the snapshot, only in the journal.
+        for (int i = 0; i < 100; ++i)
+            sessions.remove_session (imsi (i));
+        for (int i = 1000; i < 1050; ++i)
+            sessions.create_session (imsi (i));
+        store.flush_journal ();
+
+        // What a crash right now would leave behind; the store's own files get a final snapshot on destruction.
+        for (const auto* suffix : { "", ".journal" })
+            std::filesystem::copy_file (s.session_snapshot_file + suffix, crashed.session_snapshot_file + suffix,
+            std::filesystem::copy_options::overwrite_existing);
+    }
+
+    const std::pair<const Common::ServerSettings*, uint64_t> restarts[] = { { &crashed, 1 }, { &s, 2 } };
+    for (const auto& [settings, generation] : restarts) {
+        SessionManager sessions (settings->session_timeout_sec, writer, logger);
+        SessionStore store (*settings, sessions, logger);
+        EXPECT_EQ (store.restore (), 950u);
+        EXPECT_EQ (store.generation (), generation);
+        EXPECT_FALSE (sessions.has_session (imsi (0)));
+        EXPECT_TRUE (sessions.has_session (imsi (100)));
+        EXPECT_TRUE (sessions.has_session (imsi (1049)));
+        EXPECT_EQ (sessions.session_count (), 950u);
+    }
+
+    // Sessions that would have expired while the server was down are not restored.
+    auto expired                = s;
+    expired.session_timeout_sec = 0;
+    SessionManager sessions (0, writer, logger);
+    EXPECT_EQ (SessionStore (expired, sessions, logger).restore (), 0u);
+}
+
+TEST (SessionManagerTest, JournalSkipsRecentRefreshesWithoutAllocating) {
+    Common::ServerSettings s{};
+    s.cdr_file        = (temp_dir () / "cdr_journal_test.log").string ();
+    const auto logger = make_null_logger ();
+    CdrWriter writer (s, logger);
+    SessionManager manager (60, writer, logger, 1);
+    manager.set_journaling (true);
+    std::vector<Common::Imsi> imsis;
+    for (int i = 0; i < 10; ++i) {
+        imsis.push_back (make_imsi ("25099100000" + std::to_string (2000 + i)));
+        manager.create_session (imsis.back ());
+    }
+
+    std::vector<SessionManager::SessionEvent> events;
+    manager.take_journal (0, events);
+    EXPECT_EQ (events.size (), 10u);
+    manager.remove_session (imsis.back ());
+    imsis.pop_back ();
+
+    // Refreshed well within timeout / JOURNAL_REFRESH_DIVISOR of their creation, so none of these is journaled, and
+    // swapping the journal buffers back and forth allocates nothing.
+    const std::size_t before = g_heap_allocations.load ();
+    for (int round = 0; round < 100; ++round) {
+        for (const auto& imsi : imsis)
+            EXPECT_TRUE (manager.refresh_session (imsi));
+        manager.take_journal (0, events);
+        EXPECT_EQ (events.size (), round == 0 ? 1u : 0u);
+    }
+    EXPECT_EQ (g_heap_allocations.load () - before, 0u);
+}
+
+TEST_F (UdpServerFixture, GracefulStopKeepsSessionsForWarmRestart) {
+    auto s                              = loopback_settings (19112);
+    s.graceful_shutdown_rate            = 10'000;
+    s.session_snapshot_file             = (temp_dir () / "sessions_graceful.snap").string ();
+    s.session_snapshot_interval_sec     = 0;
+    s.session_journal                   = true;
+    s.session_journal_flush_interval_ms = 10;
+    std::filesystem::remove (s.session_snapshot_file);
+    std::filesystem::remove (s.session_snapshot_file + ".journal");
+
+    prepare (s);
+    auto store = std::make_unique<SessionStore> (s, *_sessions, _logger);
+    EXPECT_EQ (store->restore (), 0u);
+    store->start ();
+    auto& server = start_server ();
+    auto& cl     = connect_client ("graceful_restart_client.log");
+    constexpr std::size_t attached = 20;
+    for (std::size_t i = 0; i < attached; ++i) {
+        cl.send_imsi ("2509900000" + std::to_string (20000 + i));
+        EXPECT_EQ (cl.receive (), "created");
+    }
+
+    // Shutdown as main does it: final snapshot, then the offload empties the table.
+    store->stop ();
+    server.initiate_graceful_shutdown ();
+    server.stop ();
+    EXPECT_EQ (server.offload_progress ().removed, attached);
+    EXPECT_EQ (_sessions->session_count (), 0u);
+    store.reset ();
+
+    SessionManager restarted (s.session_timeout_sec, *_cdr, _logger);
+    EXPECT_EQ (SessionStore (s, restarted, _logger).restore (), attached);
+    EXPECT_EQ (restarted.session_count (), attached);
+    EXPECT_TRUE (restarted.has_session (make_imsi ("250990000020000")));
+}
+
 TEST (CdrWriterTest, WriteAndFlushCreatesLine) {
     Common::ServerSettings s{};
     s.cdr_file = (temp_dir () / "cdr_single_test.log").string ();
     {
         CdrWriter writer (s, make_null_logger ());
-        writer.write ("250990000000003", "created");
+        writer.write (make_imsi ("250990000000003"), Common::CdrAction::created);
         writer.flush ();
     }
     std::ifstream in (s.cdr_file);
@@ -136,6 +735,230 @@ TEST (CdrWriterTest, WriteAndFlushCreatesLine) {
     EXPECT_NE (line.find ("created"), std::string::npos);
 }
 
+TEST (CdrWriterTest, ShutdownDrainsConcurrentProducers) {
+    Common::ServerSettings s{};
+    s.cdr_file              = (temp_dir () / "cdr_drain_test.log").string ();
+    s.cdr_flush_bytes       = 1 << 20;
+    s.cdr_flush_interval_ms = 60'000;
+    std::filesystem::remove (s.cdr_file);
+
+    constexpr std::size_t threads = 4, per_thread = 20'000;
+    {
+        CdrWriter writer (s, make_null_logger ());
+        std::vector<std::thread> producers;
+        for (std::size_t t = 0; t < threads; ++t) {
+            producers.emplace_back ([&, t] {
+                for (std::size_t i = 0; i < per_thread; ++i)
+                    writer.write (make_imsi ("2509930000" + std::to_string (10000 + t)), Common::CdrAction::timeout);
+            });
+        }
+        for (auto& p : producers)
+            p.join ();
+    }
+
+    std::ifstream in (s.cdr_file);
+    std::size_t lines = 0;
+    for (std::string line; std::getline (in, line); ++lines)
+        ASSERT_NE (line.find (", timeout"), std::string::npos) << line;
+    EXPECT_EQ (lines, threads * per_thread);
+}
+
+static std::size_t count_cdr_lines (const std::filesystem::path& dir) {
+    std::size_t lines = 0;
+    for (const auto& entry : std::filesystem::directory_iterator (dir)) {
+        std::ifstream in (entry.path ());
+        for (std::string line; std::getline (in, line);)
+            ++lines;
+    }
+    return lines;
+}
+
+TEST (CdrWriterTest, RotatesBySize) {
+    const auto dir = temp_dir () / "cdr_rotation";
+    std::filesystem::remove_all (dir);
+    std::filesystem::create_directories (dir);
+    Common::ServerSettings s{};
+    s.cdr_file         = (dir / "cdr.log").string ();
+    s.cdr_flush_bytes  = 1;
+    s.cdr_rotate_bytes = 256;
+
+    constexpr std::size_t records = 100;
+    {
+        CdrWriter writer (s, make_null_logger ());
+        for (std::size_t i = 0; i < records; ++i)
+            writer.write (make_imsi ("2509940000" + std::to_string (10000 + i)), Common::CdrAction::created);
+        writer.flush ();
+        EXPECT_GE (writer.rotations (), 10u);
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator (dir))
+        EXPECT_LT (std::filesystem::file_size (entry.path ()), 256u + 64u) << entry.path ();
+    EXPECT_EQ (count_cdr_lines (dir), records);
+}
+
+TEST (CdrWriterTest, CountsRecordsWhileFileCannotOpen) {
+    const auto dir = temp_dir () / "cdr_unwritable";
+    std::filesystem::remove_all (dir);
+    std::filesystem::create_directories (dir);
+    Common::ServerSettings s{};
+    s.cdr_file         = (dir / "cdr.log").string ();
+    s.cdr_flush_bytes  = 1;
+    s.cdr_rotate_bytes = 1;
+
+    CdrWriter writer (s, make_null_logger ());
+    // The first record goes to the open file; the rotation after it cannot reopen the removed directory.
+    std::filesystem::remove_all (dir);
+    writer.write (make_imsi ("250995000010000"), Common::CdrAction::created);
+    writer.flush ();
+    writer.write (make_imsi ("250995000010001"), Common::CdrAction::created);
+    writer.write (make_imsi ("250995000010002"), Common::CdrAction::created);
+    writer.flush ();
+    EXPECT_EQ (writer.unwritten (), 2u);
+
+    // The next flush opens the file again.
+    std::filesystem::create_directories (dir);
+    writer.write (make_imsi ("250995000010003"), Common::CdrAction::created);
+    writer.flush ();
+    EXPECT_EQ (writer.unwritten (), 2u);
+    EXPECT_EQ (count_cdr_lines (dir), 1u);
+}
+
+#ifdef PGW_HAVE_ZLIB
+TEST (CdrWriterTest, CompressesRotatedSegments) {
+    const auto dir = temp_dir () / "cdr_compression";
+    std::filesystem::remove_all (dir);
+    std::filesystem::create_directories (dir);
+    Common::ServerSettings s{};
+    s.cdr_file         = (dir / "cdr.log").string ();
+    s.cdr_flush_bytes  = 1;
+    s.cdr_rotate_bytes = 256;
+    s.cdr_compression  = "gzip";
+
+    constexpr std::size_t records = 50;
+    {
+        CdrWriter writer (s, make_null_logger ());
+        for (std::size_t i = 0; i < records; ++i)
+            writer.write (make_imsi ("2509950000" + std::to_string (10000 + i)), Common::CdrAction::created);
+    }
+
+    std::size_t lines = 0;
+    for (const auto& entry : std::filesystem::directory_iterator (dir)) {
+        const auto& path = entry.path ();
+        if (path.filename () == "cdr.log") {
+            std::ifstream in (path);
+            for (std::string line; std::getline (in, line);)
+                ++lines;
+            continue;
+        }
+        ASSERT_EQ (path.extension (), ".gz") << path;
+        gzFile in = gzopen (path.c_str (), "rb");
+        ASSERT_NE (in, nullptr);
+        char buf[4096];
+        for (int n; (n = gzread (in, buf, sizeof buf)) > 0;)
+            lines += static_cast<std::size_t> (std::count (buf, buf + n, '\n'));
+        gzclose (in);
+    }
+    EXPECT_EQ (lines, records);
+}
+#endif
+
+TEST (CdrWriterTest, BinaryRecordsRenderLikeText) {
+    Common::ServerSettings s{};
+    s.cdr_file   = (temp_dir () / "cdr_binary_test.bin").string ();
+    s.cdr_format = "binary";
+    std::filesystem::remove (s.cdr_file);
+    const auto imsi = make_imsi ("250990000000042");
+    {
+        CdrWriter writer (s, make_null_logger ());
+        writer.write (imsi, Common::CdrAction::created, 7);
+        writer.write (imsi, Common::CdrAction::timeout, 7);
+    }
+
+    std::ifstream in (s.cdr_file, std::ios::binary);
+    Common::CdrFileHeader header{};
+    in.read (reinterpret_cast<char*> (&header), sizeof header);
+    ASSERT_TRUE (header.valid ());
+    Common::CdrRecord records[3]{};
+    in.read (reinterpret_cast<char*> (records), sizeof records);
+    ASSERT_EQ (in.gcount (), static_cast<std::streamsize> (2 * sizeof (Common::CdrRecord)));
+
+    EXPECT_EQ (records[0].imsi, imsi.raw ());
+    EXPECT_EQ (records[0].shard, 7u);
+    EXPECT_EQ (records[1].sequence, records[0].sequence + 1);
+    EXPECT_EQ (records[1].action, Common::CdrAction::timeout);
+
+    Common::TimestampCache timestamps;
+    char line[Common::MAX_CDR_LINE];
+    const std::string_view text (line, Common::format_cdr_line (records[0], timestamps, line));
+    EXPECT_EQ (text.substr (text.find (',')), ", 250990000000042, created\n");
+    EXPECT_EQ (text.substr (0, text.find (',')), timestamps.format (records[0].epoch_ns));
+}
+
+TEST (TimestampCacheTest, MatchesGmtimeAcrossSeconds) {
+    Common::TimestampCache seconds, millis (true);
+    const auto base = std::chrono::sys_days{ std::chrono::year{ 2024 } / 2 / 29 } + std::chrono::hours (23)
+    + std::chrono::minutes (59) + std::chrono::seconds (59);
+
+    EXPECT_EQ (seconds.format (base + std::chrono::milliseconds (7)), "2024-02-29T23:59:59Z");
+    EXPECT_EQ (millis.format (base + std::chrono::milliseconds (7)), "2024-02-29T23:59:59.007Z");
+    EXPECT_EQ (millis.format (base + std::chrono::milliseconds (999)), "2024-02-29T23:59:59.999Z");
+    EXPECT_EQ (millis.format (base + std::chrono::milliseconds (1000)), "2024-03-01T00:00:00.000Z");
+    EXPECT_EQ (seconds.format (base + std::chrono::seconds (1)), "2024-03-01T00:00:00Z");
+}
+
+TEST (HistogramTest, BucketsBoundValuesWithinOneSixteenth) {
+    for (const uint64_t v : std::initializer_list<uint64_t>{ 0, 1, 31, 32, 1000, 123'456'789, UINT64_MAX }) {
+        const auto b = Common::Histogram::bucket_of (v);
+        ASSERT_LT (b, Common::Histogram::BUCKETS);
+        EXPECT_LE (Common::Histogram::bucket_low (b), v);
+        EXPECT_GE (Common::Histogram::bucket_high (b), v);
+        EXPECT_LE (Common::Histogram::bucket_high (b) - Common::Histogram::bucket_low (b), v / 16);
+    }
+    for (std::size_t b = 1; b < Common::Histogram::BUCKETS; ++b)
+        ASSERT_EQ (Common::Histogram::bucket_low (b), Common::Histogram::bucket_high (b - 1) + 1);
+
+    Common::Histogram h;
+    for (uint64_t v = 1; v <= 10'000; ++v)
+        h.record (v * 1000);
+    const auto snap = h.snapshot ();
+    EXPECT_EQ (snap.count, 10'000u);
+    EXPECT_NEAR (static_cast<double> (snap.quantile (0.5)), 5e6, 5e6 / 16);
+    EXPECT_NEAR (static_cast<double> (snap.quantile (0.99)), 9.9e6, 9.9e6 / 16);
+    EXPECT_EQ (snap.count_at_most ((1 << 20) - 1), (1u << 20) / 1000);
+}
+
+TEST (ImsiTest, PacksAndFormatsDigits) {
+    const auto imsi = make_imsi ("250990123456789");
+    ASSERT_TRUE (imsi.valid ());
+    EXPECT_EQ (imsi.length (), 15u);
+    EXPECT_EQ (imsi.to_string (), "250990123456789");
+    EXPECT_EQ (fmt::format ("{}", imsi), "250990123456789");
+    EXPECT_EQ (Common::Imsi::from_raw (imsi.raw ()), imsi);
+}
+
+TEST (ImsiTest, RejectsMalformedInput) {
+    EXPECT_FALSE (make_imsi ("").valid ());
+    EXPECT_FALSE (make_imsi ("2509901234567890").valid ());
+    EXPECT_FALSE (make_imsi ("25099x").valid ());
+    const uint8_t bad_bcd[] = { 0x52, 0xA0 };
+    EXPECT_FALSE (Common::Imsi::from_bcd (bad_bcd, sizeof bad_bcd).valid ());
+}
+
+TEST (ImsiTest, OrderMatchesDigitStrings) {
+    EXPECT_LT (make_imsi ("25099"), make_imsi ("250990"));
+    EXPECT_LT (make_imsi ("250990"), make_imsi ("25100"));
+    EXPECT_LT (make_imsi ("001010111111111"), make_imsi ("250990000000000"));
+}
+
+TEST (ImsiTest, FromBcdMatchesStringDecoder) {
+    for (const std::string digits : { "12345678901234", "123456789012345", "0010101" }) {
+        const auto bcd = encode_imsi_bcd (digits);
+        EXPECT_EQ (Common::Imsi::from_bcd (bcd.data (), bcd.size ()), make_imsi (digits));
+        EXPECT_EQ (Common::Imsi::from_bcd (bcd.data (), bcd.size ()).to_string (),
+        Pgw::UdpServer::bcd_to_imsi (bcd.data (), bcd.size ()));
+    }
+}
+
 TEST (UdpServerTest, BcdToImsiEvenDigits) {
     const std::string imsi    = "12345678901234";
     const auto bcd            = encode_imsi_bcd (imsi);
@@ -150,6 +973,105 @@ TEST (UdpServerTest, BcdToImsiOddDigits) {
     EXPECT_EQ (decoded, imsi);
 }
 
+TEST (SlotPoolTest, RecyclesPreallocatedSlots) {
+    Pgw::SlotPool<Pgw::UdpPacket, 8> pool;
+    std::set<Pgw::UdpPacket*> slots;
+    for (std::size_t i = 0; i < pool.capacity (); ++i) {
+        auto* slot = pool.acquire ();
+        ASSERT_NE (slot, nullptr);
+        EXPECT_TRUE (pool.owns (slot));
+        slots.insert (slot);
+    }
+    EXPECT_EQ (slots.size (), pool.capacity ());
+    EXPECT_EQ (pool.acquire (), nullptr);
+    EXPECT_EQ (pool.exhausted (), 1u);
+
+    for (auto* slot : slots)
+        pool.release (slot);
+    for (std::size_t i = 0; i < pool.capacity (); ++i)
+        EXPECT_TRUE (slots.contains (pool.acquire ()));
+}
+
+TEST (SourceRateLimiterTest, BucketsPerSourceInBoundedTable) {
+    constexpr int64_t second = 1'000'000'000;
+    Pgw::SourceRateLimiter limiter (10, 5, 16);
+    for (int i = 0; i < 5; ++i)
+        EXPECT_TRUE (limiter.admit (1, second));
+    EXPECT_FALSE (limiter.admit (1, second));
+    EXPECT_TRUE (limiter.admit (2, second));
+    // 10/s refills one token every 100 ms.
+    EXPECT_FALSE (limiter.admit (1, second + second / 20));
+    EXPECT_TRUE (limiter.admit (1, second + second / 10));
+    EXPECT_FALSE (limiter.admit (1, second + second / 10));
+
+    // A storm from many addresses recycles the idlest entries instead of growing the table.
+    for (uint32_t addr = 100; addr < 1100; ++addr)
+        EXPECT_TRUE (limiter.admit (addr, 2 * second + addr));
+    EXPECT_EQ (limiter.capacity (), 16u);
+    EXPECT_EQ (limiter.tracked (), 16u);
+
+    Pgw::SourceRateLimiter off (0, 5, 16);
+    for (int i = 0; i < 100; ++i)
+        EXPECT_TRUE (off.admit (1, second));
+}
+
+TEST (AdaptiveWaiterTest, TimesOutWhenNothingArrives) {
+    Pgw::AdaptiveWaiter waiter (4, 1);
+    EXPECT_FALSE (waiter.wait ([] { return false; }, std::chrono::milliseconds (5)));
+    EXPECT_EQ (waiter.parks (), 1u);
+}
+
+TEST (AdaptiveWaiterTest, NotifyWakesParkedConsumer) {
+    Pgw::AdaptiveWaiter waiter (4, 1);
+    std::atomic<bool> ready{ false };
+    const auto start = std::chrono::steady_clock::now ();
+    std::thread producer ([&] {
+        std::this_thread::sleep_for (std::chrono::milliseconds (20));
+        ready.store (true);
+        waiter.notify ();
+    });
+    const bool woke = waiter.wait ([&] { return ready.load (); }, std::chrono::seconds (10));
+    producer.join ();
+
+    EXPECT_TRUE (woke);
+    EXPECT_LT (std::chrono::steady_clock::now () - start, std::chrono::seconds (5));
+}
+
+TEST_F (UdpServerFixture, SteadyStateDataPlaneDoesNotAllocate) {
+    auto s           = loopback_settings (19103);
+    s.udp_batch_size = 8;
+
+    auto& server = start_server (s);
+
+    const int fd = connect_socket ();
+
+    std::vector<std::vector<uint8_t> > payloads;
+    for (std::size_t i = 0; i < 16; ++i)
+        payloads.push_back (encode_imsi_bcd ("2509900000002" + std::to_string (10 + i)));
+    const auto round_trip = [&] {
+        for (const auto& p : payloads)
+            send (fd, p.data (), p.size (), 0);
+        std::size_t received = 0;
+        char buf[64];
+        pollfd pfd{ fd, POLLIN, 0 };
+        while (received < payloads.size () && poll (&pfd, 1, 500) > 0)
+            while (recv (fd, buf, sizeof buf, MSG_DONTWAIT) > 0)
+                ++received;
+        return received;
+    };
+
+    ASSERT_EQ (round_trip (), payloads.size ());
+    const std::size_t before = g_heap_allocations.load ();
+    std::size_t answered     = 0;
+    for (int i = 0; i < 20; ++i)
+        answered += round_trip ();
+    const std::size_t after = g_heap_allocations.load ();
+
+    EXPECT_EQ (answered, 20 * payloads.size ());
+    EXPECT_EQ (after - before, 0u);
+    EXPECT_EQ (server.io_stats ().pool_exhausted, 0u);
+}
+
 TEST (SettingsLoaderTest, LoadServerSettingsFromJson) {
     Common::ServerSettings reference{};
     reference.udp_ip                 = "0.0.0.0";
@@ -172,16 +1094,386 @@ TEST (SettingsLoaderTest, LoadServerSettingsFromJson) {
     std::ofstream (cfg_path) << j.dump ();
 
     setenv ("SERVER_CFG", cfg_path.c_str (), 1);
-    const auto [udp_ip, udp_port, session_timeout_sec, cdr_file, http_port, graceful_shutdown_rate, log_file, log_level,
-    blacklist] = Common::SettingsLoader::load<Common::ServerSettings> ("SERVER_CFG");
-
-    EXPECT_EQ (udp_ip, reference.udp_ip);
-    EXPECT_EQ (udp_port, reference.udp_port);
-    EXPECT_EQ (session_timeout_sec, reference.session_timeout_sec);
-    EXPECT_EQ (cdr_file, reference.cdr_file);
-    EXPECT_EQ (http_port, reference.http_port);
-    EXPECT_EQ (graceful_shutdown_rate, reference.graceful_shutdown_rate);
-    EXPECT_EQ (log_file, reference.log_file);
-    EXPECT_EQ (log_level, reference.log_level);
-    EXPECT_EQ (blacklist, reference.blacklist);
+    const auto loaded = Common::SettingsLoader::load<Common::ServerSettings> ("SERVER_CFG");
+
+    EXPECT_EQ (loaded.udp_ip, reference.udp_ip);
+    EXPECT_EQ (loaded.udp_port, reference.udp_port);
+    EXPECT_EQ (loaded.session_timeout_sec, reference.session_timeout_sec);
+    EXPECT_EQ (loaded.cdr_file, reference.cdr_file);
+    EXPECT_EQ (loaded.http_port, reference.http_port);
+    EXPECT_EQ (loaded.graceful_shutdown_rate, reference.graceful_shutdown_rate);
+    EXPECT_EQ (loaded.log_file, reference.log_file);
+    EXPECT_EQ (loaded.log_level, reference.log_level);
+    EXPECT_EQ (loaded.blacklist, reference.blacklist);
+    EXPECT_EQ (loaded.udp_shards, 1u);
+    EXPECT_TRUE (loaded.udp_shard_cpus.empty ());
+}
+
+TEST (SettingsLoaderTest, LoadShardSettingsFromJson) {
+    const nlohmann::json j = { { "udp_ip", "127.0.0.1" }, { "udp_port", 9000 }, { "udp_shards", 4 },
+        { "udp_shard_cpus", nlohmann::json::array ({ 0, 2 }) } };
+
+    auto cfg_path = temp_dir () / "server_settings_shards.json";
+    std::ofstream (cfg_path) << j.dump ();
+
+    setenv ("SERVER_CFG", cfg_path.c_str (), 1);
+    const auto loaded = Common::SettingsLoader::load<Common::ServerSettings> ("SERVER_CFG");
+
+    EXPECT_EQ (loaded.udp_shards, 4u);
+    EXPECT_EQ (loaded.udp_shard_cpus, (std::vector<int>{ 0, 2 }));
+    EXPECT_EQ (loaded.cdr_file, "cdr.log");
+    EXPECT_EQ (loaded.session_timeout_granularity_ms, 1000u);
+    EXPECT_EQ (loaded.http_threads, 4u);
+}
+
+TEST_F (UdpServerFixture, ShardedServerAnswersAllClients) {
+    auto s       = loopback_settings (19101);
+    s.udp_shards = 4;
+
+    auto& server = start_server (s);
+    EXPECT_EQ (server.shard_count (), 4u);
+
+    constexpr std::size_t clients = 16;
+    for (std::size_t i = 0; i < clients; ++i) {
+        client::UdpClient cl (client_settings ("shard_test_client.log"));
+        cl.init_sockets ();
+        cl.send_imsi ("2509900000000" + std::to_string (10 + i));
+        EXPECT_EQ (cl.receive (), "created");
+    }
+    EXPECT_EQ (server.session_count (), clients);
+}
+
+TEST_F (UdpServerFixture, MetricsCountOutcomesAndLatency) {
+    auto s = loopback_settings (19111);
+    s.blacklist = { "250990000000999" };
+
+    auto& server = start_server (s);
+    auto& cl = connect_client ("metrics_test_client.log");
+    for (const char* imsi : { "250990000000001", "250990000000001", "250990000000999" })
+        cl.send_imsi (imsi);
+    EXPECT_EQ (cl.receive (), "created");
+    EXPECT_EQ (cl.receive (), "exists");
+    EXPECT_EQ (cl.receive (), "rejected");
+    EXPECT_TRUE (wait_for ([&] { return server.response_latency ().count == 3; }, std::chrono::seconds (1)));
+
+    const auto stats = server.io_stats ();
+    EXPECT_EQ (stats.created, 1u);
+    EXPECT_EQ (stats.existing, 1u);
+    EXPECT_EQ (stats.rejected, 1u);
+    EXPECT_EQ (stats.recv_queue_depth, 0u);
+    EXPECT_EQ (stats.send_queue_depth, 0u);
+    EXPECT_GT (server.response_latency ().quantile (0.5), 0u);
+
+    std::string metrics;
+    server.append_metrics (metrics);
+    EXPECT_NE (metrics.find ("pgw_requests_total{result=\"exists\"} 1\n"), std::string::npos);
+    EXPECT_NE (metrics.find ("pgw_packets_answered_total 3\n"), std::string::npos);
+    EXPECT_NE (metrics.find ("pgw_response_latency_seconds_count 3\n"), std::string::npos);
+    EXPECT_NE (metrics.find ("pgw_cdr_queue_full_stalls_total 0\n"), std::string::npos);
+    EXPECT_NE (metrics.find ("pgw_response_latency_seconds_bucket{le=\"+Inf\"} 3\n"), std::string::npos);
+
+    // Stage histograms exist only in tracing builds; the stages of a request add up to its response latency.
+    uint64_t stage_sum = 0;
+    for (std::size_t i = 1; i < Pgw::TRACE_STAGES; ++i) {
+        const auto stage = server.stage_latency (static_cast<Pgw::TraceStage> (i));
+        EXPECT_EQ (stage.count, Pgw::TRACING_ENABLED ? 3u : 0u);
+        stage_sum += stage.sum;
+    }
+    if constexpr (Pgw::TRACING_ENABLED) {
+        EXPECT_EQ (stage_sum, server.response_latency ().sum);
+        EXPECT_NE (metrics.find ("pgw_stage_latency_seconds_count{stage=\"blacklist\"} 3\n"), std::string::npos);
+    }
+}
+
+// trace_slow_us = 1 makes every packet slow: a tracing build logs its stage breakdown at most once per
+// SLOW_TRACE_LOG_INTERVAL per shard, and a build without tracing only warns that the setting has no effect.
+TEST_F (UdpServerFixture, SlowPacketTraceIsRateLimited) {
+    auto s          = loopback_settings (19113);
+    s.udp_shards    = 1;
+    s.trace_slow_us = 1;
+
+    start_server (s);
+    auto& cl = connect_client ("slow_trace_test_client.log");
+    constexpr std::size_t rounds = 10, burst = 20;
+    const auto started = std::chrono::steady_clock::now ();
+    for (std::size_t round = 0; round < rounds; ++round) {
+        for (std::size_t i = 0; i < burst; ++i)
+            cl.send_imsi ("2509900000" + std::to_string (10000 + i));
+        for (std::size_t i = 0; i < burst; ++i)
+            EXPECT_FALSE (cl.receive ().empty ());
+        std::this_thread::sleep_for (Pgw::SLOW_TRACE_LOG_INTERVAL / 2);
+    }
+    const auto elapsed = std::chrono::steady_clock::now () - started;
+    // Destroying the server drops the last reference to its logger, which flushes the file.
+    _server.reset ();
+
+    std::ifstream in (std::filesystem::path (std::getenv ("PROJECT_DIR")) / "logs" / s.log_file);
+    std::size_t slow_lines = 0, breakdowns = 0, warnings = 0;
+    for (std::string line; std::getline (in, line);) {
+        if (line.find ("Slow packet on shard 0:") != std::string::npos) {
+            ++slow_lines;
+            breakdowns += line.find ("blacklist=") != std::string::npos && line.find ("send=") != std::string::npos;
+        }
+        warnings += line.find ("trace_slow_us is set but") != std::string::npos;
+    }
+    if constexpr (Pgw::TRACING_ENABLED) {
+        EXPECT_GE (slow_lines, 2u);
+        EXPECT_LE (slow_lines, static_cast<std::size_t> (elapsed / Pgw::SLOW_TRACE_LOG_INTERVAL) + 1);
+        EXPECT_EQ (breakdowns, slow_lines);
+        EXPECT_EQ (warnings, 0u);
+    } else {
+        EXPECT_EQ (slow_lines, 0u);
+        EXPECT_EQ (warnings, 1u);
+    }
+}
+
+TEST_F (UdpServerFixture, GracefulOffloadRejectsNewAttaches) {
+    auto s                   = loopback_settings (19105);
+    s.graceful_shutdown_rate = 2;
+
+    auto& server = start_server (s);
+    auto& cl = connect_client ("offload_test_client.log");
+    for (const char* imsi : { "250990000000001", "250990000000002" }) {
+        cl.send_imsi (imsi);
+        EXPECT_EQ (cl.receive (), "created");
+    }
+
+    // The first token goes at once, to the oldest session; the second one only after 500 ms.
+    server.initiate_graceful_shutdown ();
+    EXPECT_TRUE (wait_for ([&] { return server.session_count () == 1; }, std::chrono::milliseconds (400)));
+    cl.send_imsi ("250990000000002");
+    EXPECT_EQ (cl.receive (), "exists");
+    for (const char* imsi : { "250990000000001", "250990000000003" }) {
+        cl.send_imsi (imsi);
+        EXPECT_EQ (cl.receive (), "rejected");
+    }
+    EXPECT_EQ (server.io_stats ().refused, 2u);
+    EXPECT_EQ (server.offload_progress ().state, Pgw::OffloadScheduler::State::draining);
+
+    server.stop ();
+    EXPECT_EQ (server.session_count (), 0u);
+    EXPECT_EQ (server.offload_progress ().removed, 2u);
+    std::string metrics;
+    server.append_metrics (metrics);
+    EXPECT_NE (metrics.find ("pgw_requests_total{result=\"refused_draining\"} 2\n"), std::string::npos);
+    EXPECT_NE (metrics.find ("pgw_offload_removed_total 2\n"), std::string::npos);
+}
+
+TEST_F (UdpServerFixture, SourceRateLimitShedsExcess) {
+    auto s                   = loopback_settings (19106);
+    s.admission_source_rate  = 1;
+    s.admission_source_burst = 3;
+
+    auto& server = start_server (s);
+    auto& cl = connect_client ("admission_test_client.log");
+    for (int i = 0; i < 5; ++i)
+        cl.send_imsi ("25099000000000" + std::to_string (i));
+    EXPECT_TRUE (wait_for ([&] { return server.io_stats ().rx_packets == 5; }, std::chrono::seconds (1)));
+
+    const auto stats = server.io_stats ();
+    EXPECT_EQ (stats.shed_source_rate, 2u);
+    EXPECT_EQ (stats.shed_overload, 0u);
+    EXPECT_TRUE (wait_for ([&] { return server.session_count () == 3; }, std::chrono::seconds (1)));
+    std::string metrics;
+    server.append_metrics (metrics);
+    EXPECT_NE (metrics.find ("pgw_packets_dropped_total{reason=\"source_rate\"} 2\n"), std::string::npos);
+}
+
+TEST_F (UdpServerFixture, QueueWatermarkShedsOnlyNewAttaches) {
+    auto s                      = loopback_settings (19110);
+    s.admission_queue_watermark = 1;
+    s.udp_batch_size            = 32;
+
+    prepare (s);
+    constexpr std::size_t half = 128;
+    for (std::size_t i = 0; i < half; ++i)
+        _sessions->create_session (make_imsi ("2509960000" + std::to_string (10000 + i)));
+    auto& server = start_server ();
+
+    const int fd = connect_socket (1 << 20);
+
+    // Back to back, so a receive batch queues several packets and every one after the first is over the watermark.
+    for (std::size_t i = 0; i < half; ++i) {
+        for (const char* prefix : { "2509960000", "2509970000" }) {
+            const auto p = encode_imsi_bcd (prefix + std::to_string (10000 + i));
+            send (fd, p.data (), p.size (), 0);
+        }
+    }
+    std::size_t created = 0, exists = 0;
+    char buf[64];
+    pollfd pfd{ fd, POLLIN, 0 };
+    while (poll (&pfd, 1, 300) > 0) {
+        for (ssize_t n; (n = recv (fd, buf, sizeof buf, MSG_DONTWAIT)) > 0;) {
+            const std::string_view answer (buf, static_cast<std::size_t> (n));
+            created += answer == "created";
+            exists += answer == "exists";
+        }
+    }
+
+    server.stop ();
+    const auto stats = server.io_stats ();
+    EXPECT_EQ (stats.rx_packets, 2 * half);
+    EXPECT_EQ (exists, half);
+    EXPECT_GT (stats.shed_overload, 0u);
+    EXPECT_EQ (created + stats.shed_overload, half);
+    EXPECT_EQ (stats.shed_source_rate, 0u);
+    EXPECT_EQ (_sessions->session_count (), half + created);
+    std::string metrics;
+    server.append_metrics (metrics);
+    const auto line = "pgw_packets_dropped_total{reason=\"overload\"} " + std::to_string (stats.shed_overload) + "\n";
+    EXPECT_NE (metrics.find (line), std::string::npos);
+}
+
+TEST_F (UdpServerFixture, IoUringBackendAnswersBurst) {
+    auto s           = loopback_settings (19107);
+    s.udp_io_backend = "dpdk";
+
+    prepare (s);
+    EXPECT_THROW (Pgw::UdpServer (s, nullptr, _sessions, _blacklist, _cdr), std::invalid_argument);
+
+    s.udp_io_backend = "io_uring";
+    s.udp_batch_size = 16;
+    auto& server     = start_server (s);
+
+    const int fd = connect_socket (1 << 20);
+
+    // Sent back to back, so the multishot receive finds several datagrams per wakeup.
+    constexpr std::size_t burst = 256;
+    for (std::size_t i = 0; i < burst; ++i) {
+        const auto p = encode_imsi_bcd ("2509900000" + std::to_string (10000 + i));
+        send (fd, p.data (), p.size (), 0);
+    }
+    std::size_t created = 0;
+    char buf[64];
+    pollfd pfd{ fd, POLLIN, 0 };
+    for (std::size_t received = 0; received < burst && poll (&pfd, 1, 1000) > 0;) {
+        for (ssize_t n; (n = recv (fd, buf, sizeof buf, MSG_DONTWAIT)) > 0; ++received)
+            created += std::string_view (buf, static_cast<std::size_t> (n)) == "created";
+    }
+    EXPECT_EQ (created, burst);
+
+    server.stop ();
+    const auto stats  = server.io_stats ();
+    const auto shards = server.io_uring_shards ();
+    if (shards == 0)
+        GTEST_SKIP () << "io_uring is unavailable here (kernel or build); the shards fell back to epoll";
+    EXPECT_EQ (shards, server.shard_count ());
+    EXPECT_EQ (stats.rx_packets, burst);
+    EXPECT_EQ (stats.tx_packets, burst);
+    EXPECT_LT (stats.rx_syscalls, stats.rx_packets);
+    EXPECT_EQ (_sessions->session_count (), burst);
+}
+
+TEST_F (UdpServerFixture, RunToCompletionAnswersWithoutQueues) {
+    auto s           = loopback_settings (19108);
+    s.udp_pipeline   = "run_to_completion";
+    s.udp_shards     = 2;
+    s.udp_batch_size = 8;
+    s.blacklist      = { "250990000010063" };
+
+    auto& server = start_server (s);
+    auto& cl = connect_client ("rtc_test_client.log");
+    constexpr std::size_t burst = 64;
+    std::map<std::string, std::size_t> answers;
+    for (int round = 0; round < 2; ++round) {
+        for (std::size_t i = 0; i < burst; ++i)
+            cl.send_imsi ("2509900000" + std::to_string (10000 + i));
+        for (std::size_t i = 0; i < burst; ++i)
+            ++answers[cl.receive ()];
+    }
+    EXPECT_EQ (answers["created"], burst - 1);
+    EXPECT_EQ (answers["exists"], burst - 1);
+    EXPECT_EQ (answers["rejected"], 2u);
+
+    const auto stats = server.io_stats ();
+    EXPECT_EQ (stats.rx_packets, 2 * burst);
+    EXPECT_EQ (stats.tx_packets, 2 * burst);
+    EXPECT_EQ (stats.recv_queue_depth + stats.send_queue_depth, 0u);
+    EXPECT_EQ (server.response_latency ().count, 2 * burst);
+    server.stop ();
+
+    s.udp_io_backend = "io_uring";
+    EXPECT_THROW (Pgw::UdpServer (s, nullptr, _sessions, _blacklist, _cdr), std::invalid_argument);
+    s.udp_io_backend = "epoll";
+    s.udp_pipeline   = "reactor";
+    EXPECT_THROW (Pgw::UdpServer (s, nullptr, _sessions, _blacklist, _cdr), std::invalid_argument);
+}
+
+TEST_F (LoadGeneratorFixture, OpenLoopRunAnswersEveryScheduledRequest) {
+    auto s       = loopback_settings (19104);
+    s.udp_shards = 2;
+    s.blacklist  = { "250990000000999" };
+
+    auto& server = start_server (s);
+
+    client::LoadOptions options;
+    options.rate              = 2000;
+    options.duration_sec      = 0.25;
+    options.threads           = 2;
+    options.sockets           = 16;
+    options.repeat_ratio      = 0.3;
+    options.blacklisted_ratio = 0.1;
+    options.blacklisted       = { "250990000000999" };
+    options.seed              = 7;
+    const auto report         = client::LoadGenerator (client_settings (), options).run ();
+
+    EXPECT_EQ (report.sent, 500u);
+    EXPECT_EQ (report.answered, report.sent);
+    EXPECT_EQ (report.lost, 0u);
+    EXPECT_EQ (report.unexpected, 0u);
+    EXPECT_GT (report.existing, 0u);
+    EXPECT_GT (report.rejected, 0u);
+    EXPECT_EQ (report.created, server.session_count ());
+    EXPECT_EQ (report.latency.count, report.answered);
+}
+
+TEST_F (LoadGeneratorFixture, DroppedRequestsCountAsLost) {
+    auto s                   = loopback_settings (19109);
+    s.blacklist              = { "250990000000999" };
+    s.admission_source_rate  = 200;
+    s.admission_source_burst = 20;
+
+    auto& server = start_server (s);
+
+    client::LoadOptions options;
+    options.rate              = 2000;
+    options.duration_sec      = 0.25;
+    options.sockets           = 128;
+    options.repeat_ratio      = 0.3;
+    options.blacklisted_ratio = 0.1;
+    options.blacklisted       = { "250990000000999" };
+    options.timeout_ms        = 25;
+    options.seed              = 11;
+    const auto report         = client::LoadGenerator (client_settings (), options).run ();
+
+    // Every request the limiter sheds is lost; the answers to the rest still match their own requests.
+    EXPECT_EQ (report.sent, 500u);
+    EXPECT_EQ (report.no_socket, 0u);
+    EXPECT_EQ (report.lost, server.io_stats ().shed_source_rate);
+    EXPECT_GT (report.lost, 0u);
+    EXPECT_EQ (report.answered + report.lost, report.sent);
+    EXPECT_EQ (report.unexpected, 0u);
+    EXPECT_GT (report.existing, 0u);
+    EXPECT_EQ (report.created, server.session_count ());
+}
+
+TEST_F (UdpServerFixture, BatchedIoAnswersBurst) {
+    auto s                 = loopback_settings (19102);
+    s.udp_batch_size       = 16;
+    s.udp_flush_timeout_us = 20'000;
+
+    auto& server = start_server (s);
+    auto& cl = connect_client ("batch_test_client.log");
+
+    constexpr std::size_t burst = 32;
+    for (std::size_t i = 0; i < burst; ++i)
+        cl.send_imsi ("2509900000001" + std::to_string (10 + i));
+    for (std::size_t i = 0; i < burst; ++i)
+        EXPECT_EQ (cl.receive (), "created");
+
+    const auto stats = server.io_stats ();
+    EXPECT_EQ (stats.rx_packets, burst);
+    EXPECT_EQ (stats.tx_packets, burst);
+    EXPECT_LT (stats.tx_syscalls, burst);
+    EXPECT_EQ (server.session_count (), burst);
 }